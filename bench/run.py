@@ -0,0 +1,135 @@
+"""Benchmark harness for the VM.
+
+Compiles every bench/*.lx program once (with -O), runs it several times and
+reports median/min wall time, executed instructions per second and peak RSS.
+Results can be saved and later compared against, to catch regressions:
+
+    python bench/run.py --save bench/baseline.json
+    python bench/run.py --baseline bench/baseline.json
+
+The executed instruction count comes from one extra `vml --profile` run,
+peak RSS is the one the VM reports with --gc-stats.
+"""
+import argparse
+import hashlib
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT_DIR = os.path.dirname(BENCH_DIR)
+COMPILER = os.path.join(ROOT_DIR, "compiler", "main.py")
+
+
+def compile_program(source, output):
+    result = subprocess.run([sys.executable, COMPILER, source, "-O", output], capture_output=True, text=True)
+    if result.returncode != 0 or not os.path.exists(output):
+        raise RuntimeError(f"compiling {source} failed:\n{result.stdout}{result.stderr}")
+
+
+def run_once(vml, program, workdir):
+    """Wall time in seconds and peak RSS in KB of one run, output discarded."""
+    start = time.perf_counter()
+    result = subprocess.run([vml, "--gc-stats", program], cwd=workdir,
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    elapsed = time.perf_counter() - start
+
+    if result.returncode != 0:
+        raise RuntimeError(f"{program} exited with {result.returncode}: {result.stderr}")
+    rss = re.search(r"peak RSS (\d+) KB", result.stderr)
+    return elapsed, int(rss.group(1)) if rss else 0
+
+
+def profile_run(vml, program, workdir):
+    """Executed instructions and a hash of the program output."""
+    report = os.path.join(workdir, "profile.json")
+    result = subprocess.run([vml, "--profile-output", report, program], cwd=workdir, capture_output=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{program} exited with {result.returncode}: {result.stderr.decode()}")
+
+    with open(report) as file:
+        instructions = json.load(file)["instructions"]
+    return instructions, hashlib.sha1(result.stdout).hexdigest()[:12]
+
+
+def benchmark(name, vml, runs, workdir):
+    program = os.path.join(workdir, f"{name}.o")
+    compile_program(os.path.join(BENCH_DIR, f"{name}.lx"), program)
+
+    instructions, output = profile_run(vml, program, workdir)
+    samples = [run_once(vml, program, workdir) for _ in range(runs)]
+    times = [elapsed for elapsed, _ in samples]
+
+    median = statistics.median(times)
+    return {
+        "median_ms": median * 1e3,
+        "min_ms": min(times) * 1e3,
+        "instructions": instructions,
+        "mips": instructions / median / 1e6 if median else 0.0,
+        "peak_rss_kb": max(rss for _, rss in samples),
+        "output": output,
+    }
+
+
+def compare(result, base, threshold):
+    """Change of the median against the baseline, in percent, and a verdict."""
+    change = (result["median_ms"] / base["median_ms"] - 1) * 100 if base["median_ms"] else 0.0
+    notes = []
+    if change > threshold: notes.append("REGRESSION")
+    elif change < -threshold: notes.append("faster")
+    if result["output"] != base["output"]: notes.append("output changed")
+    return change, " ".join(notes)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the VM benchmarks")
+    parser.add_argument("names", nargs="*", help="benchmarks to run (default: all bench/*.lx)")
+    parser.add_argument("--vml", default=os.path.join(ROOT_DIR, "vml"), help="VM binary")
+    parser.add_argument("--runs", type=int, default=5, help="timed runs per benchmark")
+    parser.add_argument("--save", help="write the results to this JSON file")
+    parser.add_argument("--baseline", help="compare against results saved with --save")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="median slowdown in percent reported as a regression")
+    args = parser.parse_args()
+
+    names = args.names or sorted(f[:-3] for f in os.listdir(BENCH_DIR) if f.endswith(".lx"))
+    vml = os.path.abspath(args.vml)
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as file:
+            baseline = json.load(file)
+
+    header = f"{'benchmark':<16} {'median ms':>10} {'min ms':>10} {'M instr/s':>10} {'peak RSS':>10}"
+    print(header + ("   vs baseline" if baseline else ""))
+
+    results, regressions = {}, 0
+    with tempfile.TemporaryDirectory() as workdir:
+        for name in names:
+            result = results[name] = benchmark(name, vml, args.runs, workdir)
+            line = (f"{name:<16} {result['median_ms']:>10.1f} {result['min_ms']:>10.1f} "
+                    f"{result['mips']:>10.1f} {result['peak_rss_kb'] / 1024:>8.1f}MB")
+
+            if name in baseline:
+                change, notes = compare(result, baseline[name], args.threshold)
+                line += f"   {change:+6.1f}% {notes}"
+                regressions += "REGRESSION" in notes
+            print(line, flush=True)
+
+    if args.save:
+        with open(args.save, "w") as file:
+            json.dump(results, file, indent=2)
+            file.write("\n")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) slower than the baseline by more than {args.threshold}%")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
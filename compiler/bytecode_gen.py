@@ -1,15 +1,20 @@
 from utils.syntax_tree import *
-from utils.utils import opcodes, built_in_funcs, operations, encode_cast_arg
+from utils.utils import opcodes, built_in_funcs, operations, encode_cast_arg, typed_operation, integer_types
+from constant_pool import ConstantPool
 
 class ByteCodeCompiler:
     def __init__(self):
         self.length = 0
         self.bytecode = []
+        self.code_addresses = set() # Instructions whose arg is a bytecode position
+        self.constants = ConstantPool()
 
-        self.memory = 0
+        self.memory = 0 # Global slots assigned so far
         self.identifiers = {}
         self.heap = []
         self.structs = {}
+        self.functions = {} # Function name -> start position, for CALL_DIRECT
+        self.locals = None # Name -> slot in the frame of the function being compiled
         self.table_type = {}
 
         self.b_c_statement = [0, '']
@@ -19,12 +24,39 @@ class ByteCodeCompiler:
         self.bytecode.append(instruction)
         self.length += 1
     
+    def compile_program(self, ast: BlockNode):
+        self.append_bytecode((opcodes["GLOBALS"], 0))
+        self.generate_bytecode(ast)
+        self.bytecode[0] = (opcodes["GLOBALS"], self.memory)
+
     def generate_bytecode(self, ast: BlockNode):
         for statement in ast.statements:
             self.add_instructions(statement)
 
     def get_bytecode(self):
         return self.bytecode.copy()
+
+    def declare(self, identifier: str) -> int:
+        """Inside a function the variable gets a local slot, a global slot otherwise"""
+        if self.locals is not None:
+            self.locals[identifier] = len(self.locals)
+            return self.locals[identifier]
+
+        self.identifiers[identifier] = self.memory
+        self.memory += 1
+        return self.identifiers[identifier]
+
+    def load(self, identifier: str):
+        if self.locals is not None and identifier in self.locals:
+            self.append_bytecode((opcodes["LOAD_LOCAL"], self.locals[identifier]))
+        else:
+            self.append_bytecode((opcodes["LOAD"], self.identifiers[identifier]))
+
+    def store(self, identifier: str):
+        if self.locals is not None and identifier in self.locals:
+            self.append_bytecode((opcodes["STORE_LOCAL"], self.locals[identifier]))
+        else:
+            self.append_bytecode((opcodes["STORE_MEM"], self.identifiers[identifier]))
     
     # def get_heap_relative_location(self, from_object: str, attribute: str) -> int:
     #     _info = from_object
@@ -41,30 +73,31 @@ class ByteCodeCompiler:
         if isinstance(node, BinaryExpression):
             self.add_instructions(node.right)
             self.add_instructions(node.left)
-            self.append_bytecode((opcodes[operations[node.operator]], 0))
+            self.append_bytecode((opcodes[typed_operation(node.operator, node.operand_types)], 0))
         elif isinstance(node, UnaryExpressionNode):
             if isinstance(node, Literal):
                 if node.value_type == 'INT_LITERAL':
                     self.append_bytecode((opcodes["STORE"],  int(node.value)))
                 elif node.value_type == 'FLOAT_LITERAL':
-                    self.append_bytecode((opcodes["STORE_FLOAT"], node.value))
+                    self.append_bytecode((opcodes["LOAD_CONST"], self.constants.add_float(node.value)))
                 elif node.value_type == 'BOOL_LITERAL':
                     self.append_bytecode((opcodes["STORE_BYTE"], 1 if node.value else 0))
                 elif node.value_type == 'BYTE_LITERAL':
                     self.append_bytecode((opcodes["STORE_BYTE"], node.value))
                 elif node.value_type == 'STRING_LITERAL':
                     string = node.value.replace('\\n', '\n').replace('\\t', '\t')
-                    for char in string[::-1]:
-                        self.append_bytecode((opcodes["STORE_CHAR"], ord(char)))
-                    
-                    self.append_bytecode((opcodes["BUILD_LIST"], len(string)))
+                    self.append_bytecode((opcodes["LOAD_CONST"], self.constants.add_string(string)))
                 elif '[]' in node.value_type:
-                    for item in node.value[::-1]:
-                        self.add_instructions(item)
-                    
-                    self.append_bytecode((opcodes["BUILD_LIST"], len(node.value)))
+                    constant = self.constants.add_array(node.value)
+                    if constant is not None:
+                        self.append_bytecode((opcodes["LOAD_CONST"], constant))
+                    else:
+                        for item in node.value[::-1]:
+                            self.add_instructions(item)
+                        
+                        self.append_bytecode((opcodes["BUILD_LIST"], len(node.value)))
                 elif node.value_type == 'VARIABLE':
-                    self.append_bytecode((opcodes["LOAD"], self.identifiers[node.value]))
+                    self.load(node.value)
                 else:
                     raise Exception(f"Literal Node uncontrolled: {node.to_dict()}")
 
@@ -80,10 +113,16 @@ class ByteCodeCompiler:
                     pass
                 else:
                     if node.from_obj != 'System':
-                        self.append_bytecode((opcodes["LOAD"], self.identifiers[node.from_obj]))
+                        self.load(node.from_obj)
 
                     if node.identifier in built_in_funcs:
                         self.append_bytecode((opcodes["SYSCALL"], built_in_funcs[node.identifier]))
+                    elif node.identifier in self.functions:
+                        self.code_addresses.add(self.length)
+                        self.append_bytecode((opcodes["CALL_DIRECT"], self.functions[node.identifier]))
+                    elif self.locals is not None and node.identifier in self.locals:
+                        self.load(node.identifier)
+                        self.append_bytecode((opcodes["CALL"], -1))
                     elif node.identifier in self.identifiers:
                         self.append_bytecode((opcodes["CALL"], self.identifiers[node.identifier]))
                     else: 
@@ -106,11 +145,11 @@ class ByteCodeCompiler:
                     # if load_root: self.append_bytecode((opcodes["LOAD"], self.identifiers[identifier]))
                     # self.append_bytecode((opcodes["LOAD_HEAP"], self.get_heap_relative_location(node.object, node.attribute)))
                     pass
-                elif isinstance(node.attribute, UnaryExpressionNode):
-                    if load_root: self.append_bytecode((opcodes["LOAD"], self.identifiers[identifier]))
+                elif isinstance(node.attribute, Literal) and node.attribute.value_type != "VARIABLE":
+                    if load_root: self.load(identifier)
                     self.append_bytecode((opcodes["LIST_ACCESS"], node.attribute.value))
                 else:
-                    if load_root: self.append_bytecode((opcodes["LOAD"], self.identifiers[identifier]))
+                    if load_root: self.load(identifier)
                     self.add_instructions(node.attribute)
                     self.append_bytecode((opcodes["LIST_ACCESS"], -1))
             elif isinstance(node, CastingExpression):
@@ -121,9 +160,8 @@ class ByteCodeCompiler:
 
         elif isinstance(node, DeclarationNode):
             if isinstance(node, VariableDeclaration):
-                self.identifiers[node.identifier] = self.memory
-                self.memory += 1 if node.var_type in ('BOOL', 'CHAR') else 4
-                
+                self.declare(node.identifier)
+
                 if isinstance(node.initializer, NewCall):
                     self.table_type[node.identifier] = node.initializer.struct
                 
@@ -137,39 +175,43 @@ class ByteCodeCompiler:
                 else:
                     self.add_instructions(node.initializer)
 
-                self.append_bytecode((opcodes["STORE_MEM"], -1))
+                self.store(node.identifier)
             elif isinstance(node, FunctionDeclaration):
                 func_pos = self.length
 
                 self.identifiers[node.identifier] = self.memory
-                self.memory += 1 if node.return_type in ('BOOL', 'CHAR') else 4
+                self.memory += 1
 
                 self.append_bytecode((0, 0)) # STORE func_start_pos
-                self.append_bytecode((opcodes["STORE_MEM"], -1))
+                self.append_bytecode((opcodes["STORE_MEM"], self.identifiers[node.identifier]))
 
                 for arg in node.parameters:
                     if arg.type in self.structs: 
                         self.table_type[f'{node.identifier}.{arg.identifier}'] = arg.type
 
-                    self.identifiers[f'{node.identifier}.{arg.identifier}'] = self.memory
-                    self.memory += 1 if arg.type in ('BOOL', 'CHAR') else 4
-
-                    self.append_bytecode((opcodes["STORE"], 0))
-                    self.append_bytecode((opcodes["STORE_MEM"], -1))
-                
                 jump_pos = self.length
                 self.append_bytecode((0, 0)) # JUMP x
 
                 self.bytecode[func_pos] = (opcodes["STORE"], self.length)
-
+                self.code_addresses.add(func_pos)
+                self.functions[node.identifier] = self.length
+
+                # Every call gets its own frame: the parameters take the
+                # first local slots, the body's declarations the next ones
+                enclosing_locals, self.locals = self.locals, {}
+                enter_pos = self.length
+                self.append_bytecode((opcodes["ENTER"], 0))
                 for arg in node.parameters:
-                    self.append_bytecode((opcodes["STORE_MEM"], self.identifiers[f'{node.identifier}.{arg.identifier}']))
+                    self.append_bytecode((opcodes["STORE_LOCAL"], self.declare(f'{node.identifier}.{arg.identifier}')))
 
                 self.generate_bytecode(node.body)
 
-                if self.bytecode[-1][0] != opcodes["RETURN"]:
+                if self.bytecode[-1][0] not in (opcodes["RETURN"], opcodes["TAIL_CALL"]):
                     self.append_bytecode((opcodes["RETURN"], 0))
 
+                self.bytecode[enter_pos] = (opcodes["ENTER"], len(self.locals))
+                self.locals = enclosing_locals
+
                 self.bytecode[jump_pos] = ((opcodes["JUMP"], self.length))
             elif isinstance(node, ClassDeclaration):
                 self.structs[node.identifier] = [
@@ -210,7 +252,7 @@ class ByteCodeCompiler:
                         list_set.append(identifier.attribute)
                         identifier = identifier.object
 
-                    self.append_bytecode((opcodes["LOAD"], self.identifiers[identifier]))
+                    self.load(identifier)
                     
                     for setter in list_set:
                         if isinstance(setter, Literal) and setter.value_type != 'VARIABLE':
@@ -225,7 +267,7 @@ class ByteCodeCompiler:
                         self.add_instructions(node.identifier.attribute)
                         self.append_bytecode((opcodes["LIST_SET"], -1))
             else:
-                self.append_bytecode((opcodes["STORE_MEM"], self.identifiers[node.identifier]))
+                self.store(node.identifier)
         
         elif isinstance(node, IfStatement):
             self.add_instructions(node.condition)
@@ -301,10 +343,11 @@ class ByteCodeCompiler:
                 self.bytecode[self.b_c_statement[0]] = (opcodes["JUMP"], self.length)
                 self.b_c_statement = [0, '']
 
-            self.append_bytecode((opcodes["LOAD"], self.identifiers[node.variable.identifier]))
+            increment = "ADD_I" if node.variable.var_type in integer_types else "ADD"
+            self.load(node.variable.identifier)
             self.append_bytecode((opcodes["STORE"], 1))
-            self.append_bytecode((opcodes["ADD"], 0))
-            self.append_bytecode((opcodes["STORE_MEM"], self.identifiers[node.variable.identifier]))
+            self.append_bytecode((opcodes[increment], 0))
+            self.store(node.variable.identifier)
             self.append_bytecode((opcodes["JUMP"], for_condition))
             self.bytecode[for_check] = (self.bytecode[for_check], self.length)
 
@@ -315,8 +358,17 @@ class ByteCodeCompiler:
             self.in_loop = False
         
         elif isinstance(node, ReturnStatement):
-            self.add_instructions(node.expression)
-            self.append_bytecode((opcodes["RETURN"], 0))
+            call = node.expression
+            if self.locals is not None and isinstance(call, FunctionCall) and call.from_obj == 'System' \
+                and call.identifier in self.functions:
+                # Tail call: the callee reuses our frame and returns to our caller
+                for arg in call.args[::-1]:
+                    self.add_instructions(arg)
+                self.code_addresses.add(self.length)
+                self.append_bytecode((opcodes["TAIL_CALL"], self.functions[call.identifier]))
+            else:
+                self.add_instructions(node.expression)
+                self.append_bytecode((opcodes["RETURN"], 0))
 
         elif isinstance(node, BreakStatement):
             if self.in_loop:
@@ -0,0 +1,69 @@
+import struct
+
+BYTECODE_MAGIC = b"LXBC"
+BYTECODE_VERSION = 1
+
+CONST_FLOAT = 1
+CONST_ARRAY = 2
+
+# Element types as numbered by DataType in vm/includes/strucs-type.h
+data_types = {"BOOL": 1, "INT": 2, "FLOAT": 3, "CHAR": 4}
+
+# Elements are stored as the VM keeps them on the heap (see item_to_raw)
+element_encoders = {
+    "BOOL": lambda value: struct.pack("=B", int(value) & 0xFF),
+    "INT": lambda value: struct.pack("=Q", value & 0xFFFFFFFFFFFF),
+    "FLOAT": lambda value: struct.pack("=d", value),
+    "CHAR": lambda value: struct.pack("=B", ord(value) & 0xFF),
+}
+
+literal_types = {"INT_LITERAL": "INT", "FLOAT_LITERAL": "FLOAT", "BOOL_LITERAL": "BOOL", "BYTE_LITERAL": "BOOL"}
+
+class ConstantPool:
+    """Literals the VM loads once and pushes with LOAD_CONST. Identical
+    constants share one entry, so a string used in many places is interned."""
+
+    def __init__(self):
+        self.entries = []   # (kind, element type, payload, text for the listing)
+        self.index = {}
+
+    def add(self, kind: int, element_type: str, payload: bytes, text: str) -> int:
+        key = (kind, element_type, payload)
+        if key not in self.index:
+            self.index[key] = len(self.entries)
+            self.entries.append((kind, element_type, payload, text))
+
+        return self.index[key]
+
+    def add_float(self, value: float) -> int:
+        return self.add(CONST_FLOAT, "FLOAT", struct.pack("=d", value), f"FLOAT {value!r}")
+
+    def add_string(self, string: str) -> int:
+        payload = b"".join(element_encoders["CHAR"](char) for char in string)
+        return self.add(CONST_ARRAY, "CHAR", payload, f"STRING {string!r}")
+
+    def add_array(self, items: list):
+        """Pool index of a list literal whose items are all scalar literals of
+        one type, None when it has to be built at run time"""
+        types = {literal_types.get(getattr(item, "value_type", None)) for item in items}
+        if len(types) != 1 or None in types: return None
+
+        element_type = types.pop()
+        payload = b"".join(element_encoders[element_type](item.value) for item in items)
+        return self.add(CONST_ARRAY, element_type, payload, f"{element_type}[] {[item.value for item in items]}")
+
+    def listing(self) -> list:
+        return [f"CONST {i} {text}" for i, (_, _, _, text) in enumerate(self.entries)]
+
+    def serialize(self, instructions: int) -> bytes:
+        """Container header and constant section, the code follows it"""
+        section = b""
+        for kind, element_type, payload, _ in self.entries:
+            section += struct.pack("=B", kind)
+            if kind == CONST_FLOAT:
+                section += payload
+            else:
+                section += struct.pack("=BI", data_types[element_type], len(payload)) + payload
+
+        header = BYTECODE_MAGIC + struct.pack("=IIII", BYTECODE_VERSION, len(self.entries), len(section), instructions)
+        return header + section
@@ -5,6 +5,8 @@ from utils.utils import opcodes
 from lexer import lexer
 from parser import Parser
 from bytecode_gen import ByteCodeCompiler
+from optimizer import AstOptimizer
+from peephole import PeepholeOptimizer
 from utils.error import CompilationException
 
 class Compiler:
@@ -27,16 +29,35 @@ class Compiler:
         parser = Parser(self.lexer)
         self.ast = parser.get_program()
     
-    def generate_bytecode(self):
+    def generate_bytecode(self, optimize: int = 0):
+        """optimize: 0 emits the AST as is, 1 runs the peephole pass over the
+        bytecode and 2 also the AST optimizer before emission"""
+        self.stats = {}
+        if optimize >= 2:
+            optimizer = AstOptimizer(self.ast)
+            self.ast = optimizer.optimize()
+            self.stats.update(optimizer.stats)
+
         bytecode_generator = ByteCodeCompiler()
-        bytecode_generator.generate_bytecode(self.ast)
+        bytecode_generator.compile_program(self.ast)
         self.bytecode = bytecode_generator.get_bytecode()
+        self.constants = bytecode_generator.constants
+        self.stats.update({"instructions": len(self.bytecode), "constants": len(self.constants.entries)})
+
+        if optimize >= 1:
+            peephole = PeepholeOptimizer(self.bytecode, bytecode_generator.code_addresses)
+            self.bytecode = peephole.optimize()
+            self.stats.update(peephole.stats)
+            self.stats["optimized instructions"] = len(self.bytecode)
 
     def export_bytecode_doc(self, use_keywords: bool):
         extension = self.output_file[::-1][:4][::-1]
         if extension != '.txt': self.output_file = "output.txt"
 
         with open(self.output_file, "w") as file:
+            for line in self.constants.listing():
+                file.write(f"{line}\n")
+
             for element in self.bytecode:
                 instr = element[0]
                 arg = element[1]
@@ -46,6 +67,8 @@ class Compiler:
 
     def export_binary(self):
         with open(self.output_file, "wb") as file:
+            file.write(self.constants.serialize(len(self.bytecode)))
+
             for opcode, arg in self.bytecode:
                 file.write(opcode.to_bytes(1, byteorder='big'))
 
@@ -58,6 +81,12 @@ def exit_with_output(argument):
     tools.pretty_print(argument)
     sys.exit()
 
+def optimization_level() -> int:
+    """-O0, -O1 or -O2; a bare -O selects the highest level"""
+    levels = [int(arg[2:]) for arg in sys.argv if arg in ("-O0", "-O1", "-O2")]
+    if levels: return levels[-1]
+    return 2 if "-O" in sys.argv else 0
+
 def parse_arguments():
     if len(sys.argv) < 2:
         raise Exception("File to compile is needed")
@@ -66,10 +95,12 @@ def parse_arguments():
         "only_lexer": "-l" in sys.argv,
         "only_parser": "-p" in sys.argv,
         "bytecode_doc": "-d" in sys.argv,
-        "bytecode_doc_bin": "-b" in sys.argv
+        "bytecode_doc_bin": "-b" in sys.argv,
+        "optimize": optimization_level(),
+        "stats": "-s" in sys.argv
     }
 
-    output_file = sys.argv[-1] if len(sys.argv) > 2 and len(sys.argv[-1]) > 2 else "output.o"
+    output_file = sys.argv[-1] if len(sys.argv) > 2 and not sys.argv[-1].startswith("-") else "output.o"
     return sys.argv[1], output_file, options
 
 if __name__ == "__main__":
@@ -85,7 +116,9 @@ if __name__ == "__main__":
     if options["only_parser"]: 
         exit_with_output(compiler.ast.to_dict())
 
-    compiler.generate_bytecode()
+    compiler.generate_bytecode(options["optimize"])
+    if options["stats"]:
+        for key, value in compiler.stats.items(): print(f"{key}: {value}")
 
     if options["bytecode_doc"] or options["bytecode_doc_bin"]: 
         compiler.export_bytecode_doc(options["bytecode_doc"])
@@ -0,0 +1,361 @@
+import copy
+from utils.syntax_tree import *
+from utils.utils import built_in_funcs, typed_operation
+
+INT32_MIN, INT32_MAX = -2**31, 2**31 - 1 # STORE carries a 32-bit argument
+
+constant_literals = ('INT_LITERAL', 'BOOL_LITERAL', 'FLOAT_LITERAL', 'BYTE_LITERAL')
+terminators = (ReturnStatement, BreakStatement, ContinueStatement)
+
+# Typed operations that can't fail at run time, so evaluating them ahead of a loop is safe
+hoistable_operations = {
+    'ADD_I': 'INT', 'SUB_I': 'INT', 'MUL_I': 'INT',
+    'ADD_F': 'FLOAT', 'SUB_F': 'FLOAT', 'MUL_F': 'FLOAT', 'DIV_F': 'FLOAT',
+    **{f'{cmp}_{kind}': 'BOOL' for cmp in ('EQ', 'NEQ', 'LT', 'GT', 'LE', 'GE') for kind in ('I', 'F')},
+}
+
+def children(node: ASTNode) -> list:
+    """Direct child nodes of any statement or expression"""
+    if isinstance(node, BlockNode): return node.statements
+    if isinstance(node, BinaryExpression): return [node.right, node.left]
+    if isinstance(node, Literal): return node.value if isinstance(node.value, list) else []
+    if isinstance(node, (FunctionCall, NewCall)): return node.args
+    if isinstance(node, MemberAccess): return [node.object, node.attribute]
+    if isinstance(node, CastingExpression): return [node.expression]
+    if isinstance(node, VariableDeclaration): return [node.initializer]
+    if isinstance(node, FunctionDeclaration): return [node.body]
+    if isinstance(node, AssignmentNode): return [node.identifier, node.value]
+    if isinstance(node, IfStatement):
+        return [node.condition, node.then_block, *node.elif_statements, node.else_block]
+    if isinstance(node, WhileStatement): return [node.condition, node.body]
+    if isinstance(node, ForStatement): return [node.variable, node.condition, node.body]
+    if isinstance(node, ReturnStatement): return [node.expression]
+    return []
+
+def walk(node):
+    if not isinstance(node, ASTNode): return
+    yield node
+    for child in children(node):
+        yield from walk(child)
+
+def boolean(node, value: bool) -> bool:
+    return isinstance(node, Literal) and node.value_type == 'BOOL_LITERAL' and node.value is value
+
+int_operations = {
+    'ADD_I': lambda a, b: a + b, 'SUB_I': lambda a, b: a - b, 'MUL_I': lambda a, b: a * b,
+    'DIV_I': lambda a, b: a // b, 'MOD_I': lambda a, b: a % b, # int_div and int_mod also round down
+}
+float_operations = {
+    'ADD_F': lambda a, b: a + b, 'SUB_F': lambda a, b: a - b,
+    'MUL_F': lambda a, b: a * b, 'DIV_F': lambda a, b: a / b,
+}
+comparison_operations = {
+    'EQ': lambda a, b: a == b, 'NEQ': lambda a, b: a != b, 'LT': lambda a, b: a < b,
+    'GT': lambda a, b: a > b, 'LE': lambda a, b: a <= b, 'GE': lambda a, b: a >= b,
+}
+
+class AstOptimizer:
+    """Rewrites the checked AST before bytecode emission:
+        constant folding        2 * 3 + x                 ->  6 + x
+        constant propagation    int n = 4; ... n          ->  ... 4   (n is never reassigned)
+        dead code elimination   statements after return/break/continue, branches on constant conditions
+        loop-invariant hoisting while (i < n * 2) {...}   ->  int t = n * 2; while (i < t) {...}
+    Names aren't resolved per scope here, so only names declared once and never
+    assigned are propagated, and loops calling user functions, which may write
+    any global, aren't hoisted from."""
+
+    def __init__(self, ast: BlockNode):
+        self.ast = ast
+        self.stats = {}
+
+        self.declarations = {} # Name -> times declared
+        self.assigned = set()  # Names written after their declaration
+        self.constants = {}    # Name -> literal it always holds
+        self.loop_depth = 0
+        self.in_loop = True    # Mirrors ByteCodeCompiler.in_loop
+        self.temporaries = 0
+
+    def count(self, stat: str, amount: int = 1):
+        self.stats[stat] = self.stats.get(stat, 0) + amount
+
+    def optimize(self) -> BlockNode:
+        self.collect_writes()
+        self.ast.statements = self.block(self.ast.statements)
+        self.ast.statements = self.hoist_block(self.ast.statements)
+        return self.ast
+
+    def collect_writes(self):
+        for node in walk(self.ast):
+            if isinstance(node, VariableDeclaration):
+                self.declarations[node.identifier] = self.declarations.get(node.identifier, 0) + 1
+            elif isinstance(node, AssignmentNode) and isinstance(node.identifier, str):
+                self.assigned.add(node.identifier)
+            elif isinstance(node, ForStatement):
+                self.assigned.add(node.variable.identifier)
+            elif isinstance(node, FunctionDeclaration):
+                self.assigned.update(f'{node.identifier}.{param.identifier}' for param in node.parameters)
+
+    # Folding, propagation and dead code elimination
+    def removable(self, node: ASTNode, kept=(FunctionDeclaration, ClassDeclaration)) -> bool:
+        """Dead code can go unless it declares a function or struct, which are visible past their block"""
+        return not any(isinstance(item, kept) for item in walk(node))
+
+    def block(self, statements: list) -> list:
+        result = []
+        for i, statement in enumerate(statements):
+            result.extend(self.statement(statement))
+            last = result[-1] if result else None
+
+            if isinstance(last, ReturnStatement):
+                kept_nodes = (FunctionDeclaration, ClassDeclaration)
+            elif isinstance(last, terminators) and self.loop_depth and self.in_loop:
+                # ByteCodeCompiler only emits break/continue while in_loop holds, and lets
+                # a nested loop claim a pending one, so dead loops are left alone
+                kept_nodes = (FunctionDeclaration, ClassDeclaration, WhileStatement, ForStatement)
+            else:
+                continue
+
+            dead = statements[i + 1:]
+            kept = [item for item in dead if not self.removable(item, kept_nodes)]
+            self.count("removed statements", len(dead) - len(kept))
+            return result + kept
+
+        return result
+
+    def statement(self, node: ASTNode) -> list:
+        if isinstance(node, VariableDeclaration):
+            if node.initializer is not None:
+                node.initializer = self.expression(node.initializer)
+
+            name = node.identifier
+            if isinstance(node.initializer, Literal) and node.initializer.value_type in constant_literals \
+                and self.declarations.get(name) == 1 and name not in self.assigned:
+                self.constants[name] = node.initializer
+        elif isinstance(node, AssignmentNode):
+            node.value = self.expression(node.value)
+            if isinstance(node.identifier, MemberAccess):
+                node.identifier = self.expression(node.identifier)
+        elif isinstance(node, FunctionCall):
+            return [self.expression(node)]
+        elif isinstance(node, FunctionDeclaration):
+            loop_depth, self.loop_depth = self.loop_depth, 0
+            node.body.statements = self.block(node.body.statements)
+            self.loop_depth = loop_depth
+        elif isinstance(node, IfStatement):
+            return self.if_statement(node)
+        elif isinstance(node, WhileStatement):
+            node.condition = self.expression(node.condition)
+            if boolean(node.condition, False) and self.removable(node):
+                self.count("removed statements")
+                self.in_loop = False
+                return []
+
+            node.body.statements = self.loop_body(node.body.statements)
+        elif isinstance(node, ForStatement):
+            self.statement(node.variable)
+            node.condition = self.expression(node.condition)
+            node.body.statements = self.loop_body(node.body.statements)
+        elif isinstance(node, ReturnStatement):
+            node.expression = self.expression(node.expression)
+
+        return [node]
+
+    def loop_body(self, statements: list) -> list:
+        self.loop_depth += 1
+        self.in_loop = True
+        statements = self.block(statements)
+        self.in_loop = False
+        self.loop_depth -= 1
+        return statements
+
+    def if_statement(self, node: IfStatement) -> list:
+        candidates = [(node.condition, node.then_block)] + [(item.condition, item.then_block) for item in node.elif_statements]
+        branches = []
+        else_block = node.else_block
+        for i, (condition, then_block) in enumerate(candidates):
+            condition = self.expression(condition)
+
+            if boolean(condition, False) and self.removable(then_block):
+                self.count("removed branches")
+                continue
+            if boolean(condition, True):
+                # Later branches are never reached, this one runs whenever the previous ones don't
+                unreached = [block for _, block in candidates[i + 1:]] + ([else_block] if else_block else [])
+                if all(self.removable(block) for block in unreached):
+                    self.count("removed branches", len(unreached))
+                    else_block = then_block
+                    break
+
+            branches.append((condition, then_block))
+
+        if not branches:
+            return self.block(else_block.statements) if else_block else []
+
+        # Same order as ByteCodeCompiler emits them: else, elifs, then
+        for block in [else_block] + [block for _, block in branches[1:]] + [branches[0][1]]:
+            if block: block.statements = self.block(block.statements)
+
+        condition, then_block = branches[0]
+        elif_statements = [IfStatement(item, block) for item, block in branches[1:]]
+        return [IfStatement(condition, then_block, elif_statements, else_block)]
+
+    def expression(self, node):
+        if isinstance(node, BinaryExpression):
+            node.right = self.expression(node.right)
+            node.left = self.expression(node.left)
+            return self.fold(node)
+        elif isinstance(node, Literal):
+            if node.value_type == 'VARIABLE' and node.value in self.constants:
+                self.count("propagated constants")
+                return copy.copy(self.constants[node.value])
+            if isinstance(node.value, list):
+                node.value = [self.expression(item) for item in node.value]
+        elif isinstance(node, (FunctionCall, NewCall)):
+            node.args = [self.expression(arg) for arg in node.args]
+        elif isinstance(node, MemberAccess):
+            if isinstance(node.object, MemberAccess):
+                node.object = self.expression(node.object)
+            if node.list_access:
+                node.attribute = self.expression(node.attribute)
+        elif isinstance(node, CastingExpression):
+            node.expression = self.expression(node.expression)
+
+        return node
+
+    def fold(self, node: BinaryExpression):
+        """Evaluates an operation on literals the way the VM would, or returns it unchanged"""
+        a, b = node.right, node.left # Evaluation order: right is emitted first
+        if not isinstance(a, Literal) or not (b is None or isinstance(b, Literal)):
+            return node
+
+        if b is None: # not
+            if a.value_type != 'BOOL_LITERAL': return node
+            return self.folded(Literal('BOOL_LITERAL', not a.value))
+
+        operation = typed_operation(node.operator, node.operand_types)
+        kinds = (a.value_type, b.value_type)
+
+        if operation in ('AND', 'OR') and kinds == ('BOOL_LITERAL', 'BOOL_LITERAL'):
+            value = (a.value and b.value) if operation == 'AND' else (a.value or b.value)
+            return self.folded(Literal('BOOL_LITERAL', value))
+
+        if operation == 'CONCAT' and kinds == ('STRING_LITERAL', 'STRING_LITERAL'):
+            return self.folded(Literal('STRING_LITERAL', a.value + b.value))
+
+        name, _, suffix = operation.rpartition('_')
+        if suffix == 'I' and kinds == ('INT_LITERAL', 'INT_LITERAL'):
+            if name in comparison_operations:
+                return self.folded(Literal('BOOL_LITERAL', comparison_operations[name](a.value, b.value)))
+            if operation in ('DIV_I', 'MOD_I') and b.value == 0:
+                return node # Left for the VM to report
+            value = int_operations[operation](a.value, b.value)
+            return self.folded(Literal('INT_LITERAL', value)) if INT32_MIN <= value <= INT32_MAX else node
+
+        if suffix == 'F' and kinds == ('FLOAT_LITERAL', 'FLOAT_LITERAL'):
+            if name in comparison_operations:
+                return self.folded(Literal('BOOL_LITERAL', comparison_operations[name](a.value, b.value)))
+            if operation not in float_operations or (operation == 'DIV_F' and b.value == 0):
+                return node
+            return self.folded(Literal('FLOAT_LITERAL', float_operations[operation](a.value, b.value)))
+
+        return node
+
+    def folded(self, literal: Literal) -> Literal:
+        self.count("folded operations")
+        return literal
+
+    # Loop-invariant hoisting
+    def hoist_block(self, statements: list) -> list:
+        result = []
+        for statement in statements:
+            if isinstance(statement, (WhileStatement, ForStatement)):
+                result.extend(self.hoist(statement))
+                statement.body.statements = self.hoist_block(statement.body.statements)
+            elif isinstance(statement, FunctionDeclaration):
+                statement.body.statements = self.hoist_block(statement.body.statements)
+            elif isinstance(statement, IfStatement):
+                for block in [statement.then_block, statement.else_block] + [item.then_block for item in statement.elif_statements]:
+                    if block: block.statements = self.hoist_block(block.statements)
+
+            result.append(statement)
+
+        return result
+
+    def hoist(self, loop) -> list:
+        """Declarations computing the loop's invariant expressions, which are replaced by their temporaries"""
+        body = [loop.condition, loop.body]
+        for node in walk(BlockNode(body)):
+            # User functions, and the built-ins calling them, may write any global
+            if isinstance(node, FunctionCall) and (node.identifier not in built_in_funcs or node.identifier in ('map', 'filter', 'reduce')):
+                return []
+
+        written = {node.identifier for node in walk(BlockNode(body)) if isinstance(node, VariableDeclaration)}
+        written.update(node.identifier for node in walk(BlockNode(body))
+                       if isinstance(node, AssignmentNode) and isinstance(node.identifier, str))
+        if isinstance(loop, ForStatement): written.add(loop.variable.identifier)
+
+        self.written = written
+        self.hoisted = []
+        loop.condition = self.replace_invariants(loop.condition)
+        self.replace_in_block(loop.body.statements)
+        return self.hoisted
+
+    def replace_in_block(self, statements: list):
+        for node in statements:
+            if isinstance(node, IfStatement):
+                for item in [node, *node.elif_statements]:
+                    item.condition = self.replace_invariants(item.condition)
+                    self.replace_in_block(item.then_block.statements)
+                if node.else_block: self.replace_in_block(node.else_block.statements)
+            elif isinstance(node, (WhileStatement, ForStatement)):
+                if isinstance(node, ForStatement): self.replace_fields(node.variable)
+                node.condition = self.replace_invariants(node.condition)
+                self.replace_in_block(node.body.statements)
+            else:
+                self.replace_fields(node)
+
+    def invariant(self, node) -> bool:
+        if isinstance(node, Literal):
+            if node.value_type == 'VARIABLE': return node.value not in self.written
+            return node.value_type in constant_literals
+        if isinstance(node, BinaryExpression) and node.left is not None:
+            operation = typed_operation(node.operator, node.operand_types)
+            return operation in hoistable_operations and self.invariant(node.right) and self.invariant(node.left)
+
+        return False
+
+    def replace_invariants(self, node):
+        """Replaces the largest invariant operations in an expression"""
+        if isinstance(node, BinaryExpression) and self.invariant(node) \
+            and any(isinstance(item, Literal) and item.value_type == 'VARIABLE' for item in walk(node)):
+            name = f'$hoisted{self.temporaries}'
+            self.temporaries += 1
+            var_type = hoistable_operations[typed_operation(node.operator, node.operand_types)]
+            self.hoisted.append(VariableDeclaration(name, var_type, node))
+            self.count("hoisted expressions")
+            return Literal('VARIABLE', name)
+
+        self.replace_fields(node)
+        return node
+
+    def replace_fields(self, node):
+        """Applies replace_invariants to the expressions held by a node"""
+        if isinstance(node, BinaryExpression):
+            node.right = self.replace_invariants(node.right)
+            node.left = self.replace_invariants(node.left)
+        elif isinstance(node, Literal) and isinstance(node.value, list):
+            node.value = [self.replace_invariants(item) for item in node.value]
+        elif isinstance(node, (FunctionCall, NewCall)):
+            node.args = [self.replace_invariants(arg) for arg in node.args]
+        elif isinstance(node, MemberAccess):
+            if isinstance(node.object, MemberAccess): self.replace_fields(node.object)
+            if node.list_access: node.attribute = self.replace_invariants(node.attribute)
+        elif isinstance(node, CastingExpression):
+            node.expression = self.replace_invariants(node.expression)
+        elif isinstance(node, VariableDeclaration) and node.initializer is not None:
+            node.initializer = self.replace_invariants(node.initializer)
+        elif isinstance(node, AssignmentNode):
+            node.value = self.replace_invariants(node.value)
+            if isinstance(node.identifier, MemberAccess): self.replace_fields(node.identifier)
+        elif isinstance(node, ReturnStatement):
+            node.expression = self.replace_invariants(node.expression)
@@ -119,6 +119,7 @@ class Parser:
             self.next_token()
             right = self.binary_expression(operator_group + 1)
             left = BinaryExpression(operator, left, right)
+            left.operand_types = self.semantic.get_operand_types(left)
 
         return left
     
@@ -0,0 +1,120 @@
+from utils.utils import opcodes
+
+jump_opcodes = [opcodes["JUMP"], opcodes["JUMP_IF"]]
+int_comparisons = [opcodes[op] for op in ("EQ_I", "NEQ_I", "LT_I", "GT_I", "LE_I", "GE_I")]
+float_comparisons = [opcodes[op] for op in ("EQ_F", "NEQ_F", "LT_F", "GT_F", "LE_F", "GE_F")]
+
+MAX_PACKED_ADDRESS = 0xFFFF   # LOAD_LOAD_ADD packs two addresses in one arg
+MAX_PACKED_TARGET = 0xFFFFFF  # CMP_JUMP_IF_FALSE keeps the comparison in the top byte
+
+class PeepholeOptimizer:
+    """Rewrites common instruction sequences into fused superinstructions:
+        LOAD x; STORE 1; ADD_I; STORE_MEM x  ->  INC_MEM x
+        <cmp>; NOT; JUMP_IF t                ->  CMP_JUMP_IF_FALSE (cmp << 24 | t)
+        LOAD a; LOAD b; ADD_I                ->  LOAD_LOAD_ADD (a << 16 | b)
+        STORE k; ADD_I                       ->  LOAD_CONST_ADD k
+    Before that, jumps landing on a JUMP are threaded to its final target, a JUMP
+    to a RETURN becomes the RETURN and jumps to the next instruction are dropped.
+    Jump targets and function addresses are remapped afterwards."""
+
+    def __init__(self, bytecode: list, code_addresses: set):
+        self.bytecode = bytecode
+        self.code_addresses = code_addresses
+        self.stats = {}
+
+    def jump_targets(self) -> set:
+        targets = set()
+        for i, (opcode, arg) in enumerate(self.bytecode):
+            if opcode in jump_opcodes or i in self.code_addresses:
+                targets.add(arg)
+
+        return targets
+
+    def count(self, stat: str):
+        self.stats[stat] = self.stats.get(stat, 0) + 1
+
+    def thread_jumps(self):
+        code = self.bytecode
+        for i, (opcode, arg) in enumerate(code):
+            if opcode not in jump_opcodes or i in self.code_addresses: continue
+
+            target, seen = arg, {i}
+            while target < len(code) and code[target][0] == opcodes["JUMP"] and target not in seen:
+                seen.add(target)
+                target = code[target][1]
+
+            if target != arg:
+                code[i] = (opcode, target)
+                self.count("threaded jumps")
+            if opcode == opcodes["JUMP"] and target < len(code) and code[target][0] == opcodes["RETURN"]:
+                code[i] = code[target]
+                self.count("jumps to RETURN")
+
+    def match(self, i: int, targets: set):
+        code = self.bytecode
+        window = code[i:i + 4]
+        ops = [op for op, _ in window]
+
+        # Only the first instruction of a fused sequence may be a jump target
+        def fusable(length):
+            return len(window) >= length and all(i + j not in targets for j in range(1, length))
+
+        if ops[0] == opcodes["JUMP"] and window[0][1] == i + 1 and i not in self.code_addresses:
+            return None, None, 1
+
+        if fusable(4) and ops == [opcodes["LOAD"], opcodes["STORE"], opcodes["ADD_I"], opcodes["STORE_MEM"]] \
+            and window[1][1] == 1 and window[0][1] == window[3][1]:
+            return "INC_MEM", window[0][1], 4
+
+        if fusable(3) and (ops[0] in int_comparisons or ops[0] in float_comparisons) \
+            and ops[1:3] == [opcodes["NOT"], opcodes["JUMP_IF"]] and window[2][1] <= MAX_PACKED_TARGET:
+            return "CMP_JUMP_IF_FALSE", (ops[0], window[2][1]), 3
+
+        if fusable(3) and ops[0:3] == [opcodes["LOAD"], opcodes["LOAD"], opcodes["ADD_I"]] \
+            and 0 <= window[0][1] <= MAX_PACKED_ADDRESS and 0 <= window[1][1] <= MAX_PACKED_ADDRESS:
+            return "LOAD_LOAD_ADD", (window[0][1] << 16) | window[1][1], 3
+
+        if fusable(2) and ops[0:2] == [opcodes["STORE"], opcodes["ADD_I"]]:
+            return "LOAD_CONST_ADD", window[0][1], 2
+
+        return None
+
+    def optimize(self) -> list:
+        self.thread_jumps()
+        targets = self.jump_targets()
+        new_bytecode = []
+        new_code_addresses = set()
+        new_index = {}
+
+        i = 0
+        while i < len(self.bytecode):
+            new_index[i] = len(new_bytecode)
+            fused = self.match(i, targets)
+
+            if fused is None:
+                if i in self.code_addresses: new_code_addresses.add(len(new_bytecode))
+                new_bytecode.append(self.bytecode[i])
+                i += 1
+                continue
+
+            name, arg, length = fused
+            for j in range(1, length): new_index[i + j] = len(new_bytecode)
+            if name is None:
+                self.count("removed jumps")
+            else:
+                new_bytecode.append((opcodes[name], arg))
+                self.count(name)
+            i += length
+
+        new_index[len(self.bytecode)] = len(new_bytecode)
+
+        # Remap every code address to the new instruction positions
+        for i, (opcode, arg) in enumerate(new_bytecode):
+            if opcode in jump_opcodes or i in new_code_addresses:
+                new_bytecode[i] = (opcode, new_index[arg])
+            elif opcode == opcodes["CMP_JUMP_IF_FALSE"]:
+                comparison, target = arg
+                new_bytecode[i] = (opcode, (comparison << 24) | new_index[target])
+
+        self.code_addresses = new_code_addresses
+        return new_bytecode
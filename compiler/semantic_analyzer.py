@@ -19,7 +19,9 @@ class Semantic:
         ]
 
         self.non_primitive_types = ['[]']
-        self.table_type = {
+        self.table_type = {}
+        # Return types of the built-ins, apart from table_type so variables can reuse their names
+        self.built_in_types = {
             'exit'      : 'VOID',
             'print'     : 'VOID',
             'input'     : 'INT',
@@ -36,12 +38,27 @@ class Semantic:
             'slice'     : '[]',
             'map'       : '[]',
             'filter'    : '[]',
+            'reduce'    : 'FLOAT',
             'min'       : 'FLOAT',
             'max'       : 'FLOAT',
             'lower'     : 'STRING',
             'upper'     : 'STRING',
             'toString'  : 'STRING',
+            'sum'       : 'FLOAT',
+            'mean'      : 'FLOAT',
+            'dot'       : 'FLOAT',
+            'argmin'    : 'INT',
+            'argmax'    : 'INT',
+            'vec_add'   : '[]',
+            'vec_mul'   : '[]',
         }
+        # Built-ins whose VM result always has the declared type
+        self.exact_return_types = [
+            'input', 'getf', 'type', 'scan', 'read', 'write', 'size', 'is_empty',
+            'mean', 'argmin', 'argmax'
+        ]
+        # Built-ins whose result type follows their operands, see operand_result_type
+        self.operand_typed_funcs = ['vec_add', 'vec_mul', 'filter', 'map', 'reduce']
         self.functions = {}
         self.structs = {}
 
@@ -79,6 +96,8 @@ class Semantic:
     def add_new_func(self, func_name, return_type, args):
         if func_name in self.table_type:
             raise SemanticError(f'NameError: Variable {func_name} is already declared', self.lineno)
+        if func_name in utils.built_in_funcs:
+            raise SemanticError(f'NameError: Function {func_name} is a built-in', self.lineno)
 
         self.table_type[func_name] = return_type
         self.functions[func_name] = [arg.type for arg in args]
@@ -123,6 +142,10 @@ class Semantic:
             
             return self.get_var_type(expr.value)
         elif isinstance(expr, FunctionCall):
+            if expr.identifier in self.operand_typed_funcs:
+                return self.operand_result_type(expr)
+            if expr.identifier in utils.built_in_funcs:
+                return self.built_in_types[expr.identifier]
             return self.table_type[expr.identifier]
         elif isinstance(expr, MemberAccess):
             if expr.list_access:
@@ -177,6 +200,50 @@ class Semantic:
         else:
             return 'BYTE'
         
+    def operand_result_type(self, expr: FunctionCall):
+        """vec_add, vec_mul and filter return an array like their first operand, map an array
+        of what the function returns and reduce what it returns"""
+        operands = [self.get_var_type(expr.from_obj)] if expr.from_obj != 'System' else []
+        operands += [self.get_type(arg) for arg in expr.args]
+        if len(operands) < 2: return self.built_in_types[expr.identifier]
+
+        if expr.identifier == 'map': return operands[1] + '[]'
+        if expr.identifier == 'reduce': return operands[1]
+        return operands[0]
+
+    def has_exact_type(self, expr: ExpressionNode) -> bool:
+        if isinstance(expr, BinaryExpression):
+            if expr.operand_types is None: return False
+            # Generic comparisons with mixed operands produce FLOAT values in the VM
+            operation = utils.typed_operation(expr.operator, expr.operand_types)
+            return operation not in utils.comparisons
+        elif isinstance(expr, FunctionCall):
+            return expr.identifier in self.exact_return_types
+        elif isinstance(expr, MemberAccess):
+            return expr.list_access
+        elif isinstance(expr, CastingExpression):
+            return True
+
+        return isinstance(expr, Literal)
+
+    def get_operand_types(self, operation: BinaryExpression):
+        """Static types of both operands, or None when they can't be trusted at runtime"""
+        if operation.left is None: return None
+
+        operands = (operation.right, operation.left)
+        if not all(self.has_exact_type(operand) for operand in operands):
+            return None
+        
+        try:
+            operand_types = tuple(
+                operand.new_type if isinstance(operand, CastingExpression) else self.get_type(operand) 
+                for operand in operands
+            )
+        except (SemanticError, KeyError, AttributeError):
+            return None
+        
+        return None if None in operand_types else operand_types
+        
     def get_var_type(self, var_name):
         if var_name in self.table_type: return self.table_type[var_name]
 
@@ -1,11 +1,13 @@
 import os
+import re
+import subprocess
 import unittest
 from main import Compiler
 
 class TestCompiler(unittest.TestCase):
     def setUp(self):
-        self.test_files = [f"examples/example{i}.lx" for i in range(7)]
-        self.expected_outputs = [f"compiler/expected_outputs/output{i}.txt" for i in range(7)]
+        self.test_files = [f"examples/example{i}.lx" for i in range(12)]
+        self.expected_outputs = [f"compiler/expected_outputs/output{i}.txt" for i in range(12)]
         self.output_file = "compiler/expected_outputs/output-to-check.txt"
 
     def test_export_bytecode_doc(self):
@@ -34,5 +36,218 @@ class TestCompiler(unittest.TestCase):
         if os.path.exists(self.output_file):
             os.remove(self.output_file)
 
+class TestOptimizer(unittest.TestCase):
+    """Checks the -O2 bytecode of every example, and that it prints what the unoptimized one does."""
+    vml = "./vml"
+
+    def setUp(self):
+        self.test_files = [f"examples/example{i}.lx" for i in range(12)]
+        self.expected_outputs = [f"compiler/expected_outputs/optimized{i}.txt" for i in range(12)]
+        self.output_file = "compiler/expected_outputs/output-to-check.txt"
+        self.binaries = ["compiler/expected_outputs/unoptimized.o", "compiler/expected_outputs/optimized.o"]
+
+    def compile(self, test_file, output_file, optimize):
+        compiler = Compiler(test_file, output_file)
+        compiler.generate_lexer()
+        compiler.generate_ast()
+        compiler.generate_bytecode(optimize)
+        return compiler
+
+    def test_optimized_bytecode_doc(self):
+        for test_file, expected_file in zip(self.test_files, self.expected_outputs):
+            with self.subTest(test_file=test_file):
+                self.compile(test_file, self.output_file, 2).export_bytecode_doc(use_keywords=True)
+
+                with open(self.output_file, "r") as output, open(expected_file, "r") as expected:
+                    self.assertEqual(output.read(), expected.read(), f"Output mismatch for {test_file}")
+
+    def test_optimized_output(self):
+        if not os.path.exists(self.vml):
+            self.skipTest("vml isn't built")
+
+        for test_file in self.test_files:
+            with self.subTest(test_file=test_file):
+                results = []
+                for binary, optimize in zip(self.binaries, (0, 2)):
+                    self.compile(test_file, binary, optimize).export_binary()
+                    result = subprocess.run([self.vml, "--no-jit", binary], input=b"4\n", capture_output=True, timeout=60)
+                    results.append((result.returncode, result.stdout, result.stderr))
+
+                self.assertEqual(results[1], results[0], f"{test_file} prints something else with -O2")
+
+    def tearDown(self):
+        for path in (self.output_file, *self.binaries):
+            if os.path.exists(path):
+                os.remove(path)
+
+class TestJit(unittest.TestCase):
+    """Runs every example with the JIT off, on and compiling on first entry: all must agree."""
+    vml = "./vml"
+    runs = [["--no-jit"], [], ["--jit-threshold", "1"]]
+
+    def setUp(self):
+        if not os.path.exists(self.vml):
+            self.skipTest("vml isn't built")
+        self.test_files = [f"examples/example{i}.lx" for i in range(12)]
+        self.binary = "compiler/expected_outputs/jit-check.o"
+
+    def run_vm(self, flags):
+        result = subprocess.run([self.vml, *flags, self.binary], input=b"4\n", capture_output=True, timeout=60)
+        return result.returncode, result.stdout, result.stderr
+
+    def test_jit_matches_interpreter(self):
+        for test_file in self.test_files:
+            for optimize in (0, 1, 2):
+                with self.subTest(test_file=test_file, optimize=optimize):
+                    compiler = Compiler(test_file, self.binary)
+                    compiler.generate_lexer()
+                    compiler.generate_ast()
+                    compiler.generate_bytecode(optimize)
+                    compiler.export_binary()
+
+                    expected = self.run_vm(self.runs[0])
+                    for flags in self.runs[1:]:
+                        self.assertEqual(self.run_vm(flags), expected, f"{test_file} differs with {flags}")
+
+    def tearDown(self):
+        if os.path.exists(self.binary):
+            os.remove(self.binary)
+
+class TestEmitC(unittest.TestCase):
+    """Translates every example with `vml --emit-c`, builds it and compares its output with vml."""
+    vml = "./vml"
+    library = "vm/build/libvml.a"
+
+    def setUp(self):
+        if not os.path.exists(self.vml) or not os.path.exists(self.library):
+            self.skipTest("vml or the runtime library isn't built")
+        self.test_files = [f"examples/example{i}.lx" for i in range(12)]
+        self.binary = "compiler/expected_outputs/emit-c.o"
+        self.source = "compiler/expected_outputs/emit-c.c"
+        self.executable = "compiler/expected_outputs/emit-c"
+
+    def run_program(self, command):
+        result = subprocess.run(command, input=b"4\n", capture_output=True, timeout=60)
+        return result.returncode, result.stdout, result.stderr
+
+    def test_translation_matches_interpreter(self):
+        for test_file in self.test_files:
+            for optimize in (0, 1, 2):
+                with self.subTest(test_file=test_file, optimize=optimize):
+                    compiler = Compiler(test_file, self.binary)
+                    compiler.generate_lexer()
+                    compiler.generate_ast()
+                    compiler.generate_bytecode(optimize)
+                    compiler.export_binary()
+
+                    subprocess.run([self.vml, "--emit-c", self.source, self.binary], check=True)
+                    subprocess.run(["gcc", "-std=gnu11", "-O1", "-Ivm", "-o", self.executable,
+                                    self.source, self.library, "-lm", "-lpthread"], check=True)
+
+                    expected = self.run_program([self.vml, "--no-jit", self.binary])
+                    self.assertEqual(self.run_program([f"./{self.executable}"]), expected, f"{test_file} differs")
+
+    def tearDown(self):
+        for path in (self.binary, self.source, self.executable):
+            if os.path.exists(path):
+                os.remove(path)
+
+class TestThreads(unittest.TestCase):
+    """Runs map, filter and reduce over arrays large enough for the worker pool: every thread count must agree."""
+    vml = "./vml"
+    runs = [["--threads", "1"], ["--threads", "4"], ["--threads", "4", "--no-jit"], ["--threads", "4", "--gc-threshold", "1"]]
+    program = """
+func square(int x) -> int {
+    return x * x;
+}
+
+func steps(int start) -> int {
+    int n = start;
+    int count = 0;
+    while (n > 1) {
+        if (n % 2 == 0) {
+            n = n / 2;
+        } else {
+            n = 3 * n + 1;
+        }
+        count = count + 1;
+    }
+    return count;
+}
+
+func is_long(int count) -> bool {
+    return count > 100;
+}
+
+func with_constant(int x) -> int {
+    string unused = "abc";
+    return x + 1;
+}
+
+func label(int x) -> string {
+    return "#" + x;
+}
+
+func longest(string best, string x) -> string {
+    if (x.size() > best.size()) {
+        return x;
+    }
+    return best;
+}
+
+int[] values = [0];
+for (int i = 1; i < 20000) {
+    values.append(i);
+}
+print(sum(values.map(square)));
+print(" ");
+int[] counts = values.map(steps);
+print(max(counts));
+print(" ");
+int[] long_counts = filter(counts, is_long);
+print(long_counts.size());
+print(" ");
+print(sum(map(values, with_constant)));
+print(" ");
+print(reduce(values.map(label), longest, ""));
+print("\\n");
+"""
+
+    def setUp(self):
+        if not os.path.exists(self.vml):
+            self.skipTest("vml isn't built")
+        self.source = "compiler/expected_outputs/threads-check.lx"
+        self.binary = "compiler/expected_outputs/threads-check.o"
+        with open(self.source, "w") as file:
+            file.write(self.program)
+        compiler = Compiler(self.source, self.binary)
+        compiler.generate_lexer()
+        compiler.generate_ast()
+        compiler.generate_bytecode(2)
+        compiler.export_binary()
+
+    def run_vm(self, flags):
+        result = subprocess.run([self.vml, *flags, self.binary], capture_output=True, timeout=60)
+        return result.returncode, result.stdout
+
+    def test_threads_match_one_thread(self):
+        expected = self.run_vm(self.runs[0])
+        self.assertEqual(expected[0], 0)
+        for flags in self.runs[1:]:
+            self.assertEqual(self.run_vm(flags), expected, f"differs with {flags}")
+
+    def test_map_collects(self):
+        # The strings label allocates are garbage by the time reduce returns,
+        # so collections have to run while map is calling it
+        result = subprocess.run([self.vml, "--gc-stats", "--gc-threshold", "1000", self.binary], capture_output=True, timeout=60)
+        collections = re.search(rb"GC: (\d+) collections", result.stderr)
+        self.assertIsNotNone(collections)
+        self.assertGreaterEqual(int(collections.group(1)), 10)
+
+    def tearDown(self):
+        for path in (self.source, self.binary):
+            if os.path.exists(path):
+                os.remove(path)
+
 if __name__ == "__main__":
     unittest.main()
@@ -27,6 +27,7 @@ class BinaryExpression(ExpressionNode):
         self.operator = operator
         self.right = right
         self.left = left
+        self.operand_types = None # Set by the semantic analyzer when both types are known
 
     def to_dict(self) -> dict:
         return {
@@ -29,6 +29,40 @@ opcodes = {
     "DEFINE_TYPE"   : 0x1C,
     "NEW"           : 0x1D,
     "CAST"          : 0x1E,
+    "GLOBALS"       : 0x1F,
+    "ADD_I"         : 0x20,
+    "SUB_I"         : 0x21,
+    "MUL_I"         : 0x22,
+    "DIV_I"         : 0x23,
+    "MOD_I"         : 0x24,
+    "ADD_F"         : 0x25,
+    "SUB_F"         : 0x26,
+    "MUL_F"         : 0x27,
+    "DIV_F"         : 0x28,
+    "MOD_F"         : 0x29,
+    "EQ_I"          : 0x2A,
+    "NEQ_I"         : 0x2B,
+    "LT_I"          : 0x2C,
+    "GT_I"          : 0x2D,
+    "LE_I"          : 0x2E,
+    "GE_I"          : 0x2F,
+    "EQ_F"          : 0x30,
+    "NEQ_F"         : 0x31,
+    "LT_F"          : 0x32,
+    "GT_F"          : 0x33,
+    "LE_F"          : 0x34,
+    "GE_F"          : 0x35,
+    "CONCAT"        : 0x36,
+    "LOAD_CONST"    : 0x37,
+    "CALL_DIRECT"   : 0x38,
+    "TAIL_CALL"     : 0x39,
+    "LOAD_LOCAL"    : 0x3A,
+    "STORE_LOCAL"   : 0x3B,
+    "ENTER"         : 0x3C,
+    "INC_MEM"       : 0x40,
+    "LOAD_LOAD_ADD" : 0x41,
+    "CMP_JUMP_IF_FALSE" : 0x42,
+    "LOAD_CONST_ADD": 0x43,
     "SYSCALL"       : 0xFF
 }
 
@@ -39,6 +73,29 @@ operations = {
     '<': "LT", '<=': "LE", '>': "GT", '>=': "GE",
 }
 
+typed_operations = ['ADD', 'SUB', 'MUL', 'DIV', 'MOD', 'EQ', 'NEQ', 'LT', 'GT', 'LE', 'GE']
+comparisons = ['EQ', 'NEQ', 'LT', 'GT', 'LE', 'GE']
+integer_types = ('INT', 'BYTE', 'BOOL', 'CHAR')
+
+def typed_operation(operator: str, operand_types: tuple) -> str:
+    """Opcode name for a binary operator, typed when both operand types are known"""
+    operation = operations[operator]
+    if operand_types is None: return operation
+
+    if operation == 'ADD' and 'STRING' in operand_types:
+        return 'CONCAT'
+    if operation not in typed_operations:
+        return operation
+    
+    if all(op_type in integer_types for op_type in operand_types):
+        # The semantic analyzer types mixed integer divisions (e.g. INT / BYTE) as FLOAT
+        if operation == 'DIV' and operand_types[0] != operand_types[1]: return operation
+        return f'{operation}_I'
+    if all(op_type == 'FLOAT' for op_type in operand_types):
+        return f'{operation}_F'
+    
+    return operation
+
 literals = ['INT_LITERAL', 'FLOAT_LITERAL', 'STRING_LITERAL', 'BOOL_LITERAL']
 
 built_in_funcs = {
@@ -62,6 +119,14 @@ built_in_funcs = {
     'lower'     : 17,
     'upper'     : 18,
     'toString'  : 19,
+    'sum'       : 20,
+    'mean'      : 21,
+    'dot'       : 22,
+    'argmin'    : 23,
+    'argmax'    : 24,
+    'vec_add'   : 25,
+    'vec_mul'   : 26,
+    'reduce'    : 27,
 }
 
 TYPE_IDS = {
@@ -1,15 +1,23 @@
 #pragma once
 #include "strucs-type.h"
 #include "stack.h"
+#include "opcodes.h"
 #include <math.h>
 
+// Tags accepted by the _I typed opcodes (BYTE values travel as BOOL_TYPE)
+#define IS_INT_OPERAND(type) ((type) == INT_TYPE || (type) == BOOL_TYPE || (type) == CHAR_TYPE)
+
 void alu(Stack*, uint8_t);
 Item logic_unit(Stack*, uint8_t);
 Item aritmetic_unit(Stack*, uint8_t);
 
-float float_alu(Item, Item, uint8_t);
-uint32_t format_float(float);
-uint32_t int_alu(Item, Item, uint8_t);
+double float_alu(Item, Item, uint8_t);
+int64_t int_alu(Item, Item, uint8_t);
+Item typed_alu(Item, Item, uint8_t);
+
+int64_t int_div(int64_t, int64_t);
+int64_t int_mod(int64_t, int64_t);
 
-float extract_float(Item);
-float float_mod(float, float);
\ No newline at end of file
+double float_from_bits(uint32_t);
+double extract_float(Item);
+double float_mod(double, double);
@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#define ERR_COUNT 11
+#define ERR_COUNT 14
 
-uint8_t instr_pc_log;
+// Points at the last opcode dispatched on this thread, reported by handle_error.
+// Each interpreter loop points it at its own VM's `opcode` on entry.
+extern _Thread_local const uint8_t *instr_pc_log;
 
 typedef enum {
     FILE_NOT_FOUND,
@@ -17,8 +19,11 @@ typedef enum {
     FILE_PERMISSION_ERROR,
     UNSUPPORTED_COMPLEX_TYPE_WRITE,
     UNSUPPORTED_BINARY_WRITE,
+    DIVISION_BY_ZERO,
+    OPERAND_TYPE_MISMATCH,
+    INVALID_BYTECODE,
     UNDEFINED_ERROR
 } ErrorCode;
 
 extern char* error_messages[ERR_COUNT];
-void handle_error(ErrorCode code);
\ No newline at end of file
+_Noreturn void handle_error(ErrorCode code);
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+#include "../virtual_machine.h"
+
+#define GC_DEFAULT_THRESHOLD 10000
+#define GC_DEFAULT_GROWTH 2.0
+
+void gc_configure(Heap*, size_t threshold, double growth);
+void gc_collect(VM*);
+void gc_print_stats(const VM*, FILE*);
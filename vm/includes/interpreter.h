@@ -0,0 +1,198 @@
+#pragma once
+#include "../virtual_machine.h"
+#include "opcode_handlers.h"
+#include "opcodes.h"
+#include "alu.h"
+#include "gc.h"
+
+// Stack and ALU bodies shared by the threaded interpreter and programs
+// translated to C with --emit-c. Both keep pc, sp, tos and stack_limit in
+// locals of the running function:
+//
+// The top of the stack is cached in `tos`; `sp` points at its home slot,
+// which is stale until the next SAVE_STATE or push. Binary operators read
+// sp[-1] and `tos` and leave the result in `tos`.
+
+#define SAVE_STATE() (vm->pc = pc, *sp = tos, vm->stack.top = (int) (sp - vm->stack.data))
+#define LOAD_STATE() (pc = vm->pc, sp = vm->stack.data + vm->stack.top, tos = *sp)
+
+// Collections only run where every live value is reachable from the VM:
+// on jumps and calls, which every unbounded loop has to go through
+#define GC_SAFE_POINT() if (vm->heap.gc.pending) { SAVE_STATE(); gc_collect(vm); }
+
+#define NEED(n) if (sp - vm->stack.data < (n)) handle_error(STACK_UNDERFLOW)
+#define DROP(n) (sp -= (n), tos = *sp)
+#define PUSH(item) do { \
+        Item pushed = (item); \
+        if (sp >= stack_limit) handle_error(STACK_OVERFLOW); \
+        *sp++ = tos; \
+        tos = pushed; \
+    } while (0)
+
+// Binary ALU body shared by arithmetic and comparison opcodes. Arrays fall
+// back to string_format_proc, a FLOAT operand promotes the operation.
+#define BINARY_OP(int_expr, float_expr) do { \
+        NEED(2); \
+        Item right = tos, left = sp[-1]; \
+        if (HAS_TAG(left, ARRAY_TYPE) || HAS_TAG(right, ARRAY_TYPE)) { \
+            DROP(2); SAVE_STATE(); \
+            string_format_proc(vm, left, right); \
+            LOAD_STATE(); \
+        } else if (IS_FLOAT(left) || IS_FLOAT(right)) { \
+            double l = extract_float(left), r = extract_float(right); \
+            tos = FROM_FLOAT(float_expr); sp--; \
+        } else { \
+            int64_t l = AS_INT(left), r = AS_INT(right); \
+            tos = FROM_INT(int_expr); sp--; \
+        } \
+    } while (0)
+
+// DIV and MOD of two INTs give what DIV_I and MOD_I do, anything else
+// works on floats
+#define DIVISION_OP(float_expr, int_expr) do { \
+        NEED(2); \
+        Item right = tos, left = sp[-1]; \
+        if (HAS_TAG(left, ARRAY_TYPE) || HAS_TAG(right, ARRAY_TYPE)) { \
+            DROP(2); SAVE_STATE(); \
+            string_format_proc(vm, left, right); \
+            LOAD_STATE(); \
+        } else if (HAS_TAG(left, INT_TYPE) && HAS_TAG(right, INT_TYPE)) { \
+            int64_t l = AS_INT(left), r = AS_INT(right); \
+            tos = FROM_INT(int_expr); sp--; \
+        } else { \
+            double l = extract_float(left), r = extract_float(right); \
+            tos = FROM_FLOAT(float_expr); sp--; \
+        } \
+    } while (0)
+
+// Typed opcodes trust the compiler, VM_DEBUG builds verify the operand tags
+#ifdef VM_DEBUG
+#define VERIFY_OPERANDS(check) \
+    if (!(check(ITEM_TYPE(sp[-1])) && check(ITEM_TYPE(tos)))) handle_error(OPERAND_TYPE_MISMATCH)
+#else
+#define VERIFY_OPERANDS(check)
+#endif
+#define IS_FLOAT_OPERAND(type) ((type) == FLOAT_TYPE)
+
+#define INT_OP(result_type, expr) do { \
+        NEED(2); \
+        VERIFY_OPERANDS(IS_INT_OPERAND); \
+        int64_t l = AS_INT(sp[-1]), r = AS_INT(tos); \
+        tos = BOX(result_type, expr); sp--; \
+    } while (0)
+
+#define FLOAT_OP(expr) do { \
+        NEED(2); \
+        VERIFY_OPERANDS(IS_FLOAT_OPERAND); \
+        double l = AS_FLOAT(sp[-1]), r = AS_FLOAT(tos); \
+        tos = FROM_FLOAT(expr); sp--; \
+    } while (0)
+
+#define FLOAT_CMP_OP(expr) do { \
+        NEED(2); \
+        VERIFY_OPERANDS(IS_FLOAT_OPERAND); \
+        double l = AS_FLOAT(sp[-1]), r = AS_FLOAT(tos); \
+        tos = BOX(BOOL_TYPE, expr); sp--; \
+    } while (0)
+
+// 48-bit operands can overflow int64_t when multiplied, wrap instead
+#define WRAPPING_MUL(l, r) ((uint64_t) (l) * (uint64_t) (r))
+
+// Calls into the rest of the VM, which works on vm->stack
+#define SERVICE(call) do { SAVE_STATE(); call; LOAD_STATE(); } while (0)
+
+#ifdef VM_DEBUG
+#define VERIFY_INT(item) if (!IS_INT_OPERAND(ITEM_TYPE(item))) handle_error(OPERAND_TYPE_MISMATCH)
+#else
+#define VERIFY_INT(item)
+#endif
+
+#ifdef VM_DEBUG
+#define CONCAT_OP() do { \
+        NEED(2); \
+        Item right = tos, left = sp[-1]; \
+        if (!HAS_TAG(left, ARRAY_TYPE) && !HAS_TAG(right, ARRAY_TYPE)) handle_error(OPERAND_TYPE_MISMATCH); \
+        DROP(2); \
+        SERVICE(string_format_proc(vm, left, right)); \
+    } while (0)
+#else
+#define CONCAT_OP() do { \
+        NEED(2); \
+        Item right = tos, left = sp[-1]; \
+        DROP(2); \
+        SERVICE(string_format_proc(vm, left, right)); \
+    } while (0)
+#endif
+
+#define INC_MEM_OP(address) do { \
+        Item *slot = &vm->globals.slots[address]; \
+        VERIFY_INT(*slot); \
+        *slot = FROM_INT(AS_INT(*slot) + 1); \
+    } while (0)
+
+// arg: (address_a << 16) | address_b
+#define LOAD_LOAD_ADD_OP(arg) do { \
+        Item a = vm->globals.slots[(arg) >> 16]; \
+        Item b = vm->globals.slots[(arg) & 0xFFFF]; \
+        VERIFY_INT(a); \
+        VERIFY_INT(b); \
+        PUSH(FROM_INT(AS_INT(a) + AS_INT(b))); \
+    } while (0)
+
+#define LOAD_CONST_ADD_OP(value) do { \
+        NEED(1); \
+        VERIFY_INT(tos); \
+        tos = FROM_INT(AS_INT(tos) + (value)); \
+    } while (0)
+
+#define AND_OP() do { NEED(2); tos = BOX(BOOL_TYPE, AS_BOOL(sp[-1]) && AS_BOOL(tos)); sp--; } while (0)
+#define OR_OP()  do { NEED(2); tos = BOX(BOOL_TYPE, AS_BOOL(sp[-1]) || AS_BOOL(tos)); sp--; } while (0)
+#define NOT_OP() do { NEED(1); tos = BOX(BOOL_TYPE, !AS_BOOL(tos)); } while (0)
+
+#define STORE_MEM_OP(address) do { \
+        NEED(1); \
+        vm->globals.slots[address] = heap_own(&vm->heap, tos); \
+        DROP(1); \
+    } while (0)
+
+#define STORE_LOCAL_OP(slot) do { \
+        NEED(1); \
+        vm->locals.frame[slot] = heap_own(&vm->heap, tos); \
+        DROP(1); \
+    } while (0)
+
+// arg: element index, or -1 to take it from the stack
+#define LIST_ACCESS_OP(arg) do { \
+        uint64_t value; \
+        uint32_t index; \
+        if ((uint32_t) (arg) == (uint32_t) -1) { \
+            NEED(2); \
+            index = AS_INT(tos); \
+            DROP(1); \
+        } else { \
+            NEED(1); \
+            index = (arg); \
+        } \
+        size_t array_location = ITEM_BITS(tos); \
+        DataType array_type = vm->heap.blocks[array_location].type; \
+        size_t size_items = sizes[array_type]; \
+        heap_read(&vm->heap, array_location, &value, index * size_items, size_items); \
+        tos = item_from_raw(array_type, value); \
+    } while (0)
+
+#define LIST_SET_OP(arg) do { \
+        uint32_t index; \
+        if ((uint32_t) (arg) == (uint32_t) -1) { \
+            NEED(3); \
+            index = AS_INT(tos); \
+            DROP(1); \
+        } else { \
+            NEED(2); \
+            index = (arg); \
+        } \
+        size_t array_location = ITEM_BITS(tos); \
+        uint64_t value = item_to_raw(heap_own(&vm->heap, sp[-1])); \
+        size_t size_items = sizes[vm->heap.blocks[array_location].type]; \
+        DROP(2); \
+        heap_write(&vm->heap, array_location, value, index * size_items, size_items); \
+    } while (0)
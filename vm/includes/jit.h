@@ -0,0 +1,53 @@
+#pragma once
+#include "../virtual_machine.h"
+
+// Baseline JIT: the x86-64 code generator only exists for the threaded and
+// switch loops. VM_DEBUG builds keep every instruction in the interpreter,
+// where typed opcodes have their operand checks.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(VM_DEBUG) && !defined(VM_LEGACY_DISPATCH)
+#define JIT_SUPPORTED
+#endif
+
+#define JIT_DEFAULT_THRESHOLD 1000
+#define JIT_MAX_REGION 4096      // Instructions compiled per region at most
+
+// What compiled code sees of the VM. sp points at the top item like
+// vm->stack.top does, limit and base bound pushes and pops, vm gives
+// access to the frames.
+typedef struct {
+    Item *sp;
+    Item *globals;
+    Item *limit;
+    Item *base;
+    VM *vm;
+} JitState;
+
+// Compiled regions return the offset where the interpreter resumes
+typedef uint32_t (*JitCode)(JitState*);
+
+typedef struct {
+    void *code;
+    size_t bytes;
+} JitRegion;
+
+typedef struct Jit {
+    size_t size;               // Bytecode offsets, the HALT sentinel included
+    uint32_t threshold;
+    uint32_t *counters;        // Entries seen per offset before it is compiled, NULL in
+                               // a worker's copy, which only runs what is compiled
+    JitCode *entries;          // Compiled code entered at each offset
+
+    JitRegion *regions;
+    size_t region_count;
+    size_t region_capacity;
+
+    size_t code_bytes;
+    size_t compiled_instructions;
+    uint64_t runs;
+} Jit;
+
+Jit *jit_create(const VM*, uint32_t threshold);
+void jit_destroy(Jit*);
+void jit_enter(VM*, uint32_t offset, uint32_t end);
+void jit_compile(VM*, uint32_t offset, uint32_t end);
+void jit_print_stats(const Jit*, FILE*);
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Reductions and element-wise operations over the payload of INT and FLOAT
+// blocks: 8-byte elements, INT as the 48-bit payload and FLOAT as the raw
+// double (see item_to_raw). Each has an SSE2 and an AVX2 version on x86-64
+// and a scalar one everywhere, picked once from what the CPU supports.
+// Float sums are accumulated in the same 8 lanes in every version, so the
+// result doesn't depend on the CPU.
+
+typedef enum {
+    KERNEL_ADD_INT,
+    KERNEL_MUL_INT,
+    KERNEL_ADD_FLOAT,
+    KERNEL_MUL_FLOAT,
+} KernelOp;
+
+// NULL picks the best version the CPU supports. Returns 0 for an unknown
+// name or one the CPU can't run.
+int kernels_select(const char *name);
+const char *kernels_name(void);
+
+// Exact sum of the sign-extended INT elements
+int64_t kernel_sum_int(const uint64_t*, size_t count);
+double kernel_sum_float(const double*, size_t count);
+
+// INT products wrap like MUL_I, only the low 48 bits of the result are exact
+uint64_t kernel_dot_int(const uint64_t*, const uint64_t*, size_t count);
+double kernel_dot_float(const double*, const double*, size_t count);
+
+// Index of the first smallest element, or the first largest with `max`.
+// NaN elements are skipped unless the first element is one. count > 0.
+size_t kernel_arg_int(const uint64_t*, size_t count, int max);
+size_t kernel_arg_float(const double*, size_t count, int max);
+
+// out[i] = a[i] op b[i], INT results masked to the payload and NaN results
+// canonical, so they can be stored in a block as they are
+void kernel_elementwise(KernelOp, uint64_t *out, const uint64_t *a, const uint64_t *b, size_t count);
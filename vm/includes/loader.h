@@ -0,0 +1,39 @@
+#pragma once
+#include "../virtual_machine.h"
+
+// Container written by the compiler, integers are native-endian:
+//   header     BytecodeHeader
+//   constants  constant_count entries, constant_bytes bytes in total. Each is
+//              a kind byte, then CONST_FLOAT: a double, or CONST_ARRAY: an
+//              element DataType byte, a uint32 byte length and the elements
+//              as the heap stores them
+//   code       `instructions` packed instructions
+// Files that don't start with BYTECODE_MAGIC are bare code (pre-container).
+#define BYTECODE_MAGIC "LXBC"
+#define BYTECODE_VERSION 1
+
+#define CONST_FLOAT 1
+#define CONST_ARRAY 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t constant_count;
+    uint32_t constant_bytes;
+    uint32_t instructions;
+} BytecodeHeader;
+
+// Packed instruction: one opcode byte followed by a native-endian 32-bit arg
+#define PACKED_INSTRUCTION_SIZE 5
+
+typedef struct {
+    size_t constants;
+    size_t instructions;
+    size_t bytes;
+    double map_ms;       // open + mmap
+    double decode_ms;    // validation and decoding, a single pass
+} LoadStats;
+
+void load_program(VM*, const char *filename, LoadStats*);
+void load_image(VM*, const uint8_t *image, size_t bytes);   // A program file already in memory
+void print_load_stats(const LoadStats*, FILE*);
@@ -1,35 +1,164 @@
 #pragma once
 #include "strucs-type.h"
 #include "errors.h"
+#include "stack.h"
+#include "slab.h"
 #include <stdlib.h>
 #include <string.h>
 
 extern size_t sizes[ARRAY_TYPE + 1];
 
+// Heap elements are stored unboxed: INT as a 48-bit payload in 8 bytes,
+// FLOAT as the raw double, CHAR/BOOL as one byte and ARRAY as a 4-byte index
+static inline uint64_t item_to_raw(Item item) {
+    return IS_FLOAT(item) ? item : ITEM_BITS(item);
+}
+
+static inline Item item_from_raw(DataType type, uint64_t raw) {
+    return (type == FLOAT_TYPE) ? raw : BOX(type, raw);
+}
+
+#define INITIAL_HEAP_BLOCKS 16
+
+// Block header: size is the number of bytes in use, capacity the number
+// allocated. type is the element type, flags are used by the collector.
 typedef struct {
     uint8_t *data;
-    DataType *table_type;
-    size_t size;
+    uint32_t size;
+    uint32_t capacity;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t sharers;         // Views and rope nodes over this block, see make_writable
+    uint32_t source;          // BLOCK_VIEW: the block that owns the payload
 } Memory;
 
+// Global variables: one tagged Item per slot, slot indices assigned by the compiler
+typedef struct {
+    Item *slots;
+    size_t size;
+} Globals;
+
+// Local slots of the active calls. ENTER opens a window of its function's
+// size at `top`, RETURN closes it. `frame` points at the running function's
+// window. capacity always covers frame + window, the largest ENTER in the
+// program, so the indices the loader accepted can't leave the array.
+#define INITIAL_LOCALS 256
+#define LOCALS_LIMIT 0x10000     // Slots a single function can have
+
+typedef struct {
+    Item *slots;
+    Item *frame;
+    uint32_t top;
+    uint32_t capacity;
+    uint32_t window;
+} Locals;
+
+#define BLOCK_MARKED 0x01
+#define BLOCK_FREE   0x02
+#define BLOCK_ROPE   0x04 // Payload is a RopeNode, size is the length of the whole string
+#define BLOCK_LEAF   0x10 // Private piece of a rope, never visible to the program
+#define BLOCK_CONST  0x20 // Interned constant: never modified or swept
+#define BLOCK_VIEW   0x40 // Payload borrowed from `source` until the first write
+
+// Concatenation node. The halves are referenced, not copied, and the node is
+// flattened into a plain block the first time its payload is needed. A node
+// sees the first left_size bytes of `left` and the rest from `right`, so a
+// private leaf can keep growing in place for newer nodes.
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint32_t left_size;
+} RopeNode;
+
+// Operands up to this many bytes are copied into private leaves instead of
+// referenced, and appends fill the last leaf up to this size
+#define ROPE_LEAF_SIZE 512
+
+// Collector bookkeeping, the collector itself lives in gc.c
+typedef struct {
+    size_t allocations;       // Blocks handed out since the last collection
+    size_t threshold;         // A collection is requested when allocations reaches it
+    size_t min_threshold;
+    double growth;            // Next threshold: live blocks * growth
+    int pending;
+
+    size_t collections;
+    size_t freed_blocks;
+    size_t peak_blocks;
+    double total_pause;
+    double max_pause;
+} GCState;
+
 typedef struct {
     Memory *blocks;
-    DataType *table_type;
+    size_t *free_list;        // Indices of swept blocks, reused by heap_add_block
+    size_t free_count;
     size_t size;
+    size_t capacity;
+    GCState gc;
+    Slab slab;                // Allocator for this heap's payloads
 } Heap;
 
 void memory_init(Memory*);
-void memory_destroy(Memory*);
+void memory_destroy(Slab*, Memory*);
+
+int memory_write(Slab*, Memory*, uint32_t, uint64_t, size_t);
+int memory_read(Memory*, uint32_t, uint64_t*, size_t);
+int memory_expand(Slab*, Memory*, size_t);
+int memory_reserve(Slab*, Memory*, size_t);
+
+void globals_init(Globals*, size_t);
+void globals_destroy(Globals*);
+
+void locals_init(Locals*, uint32_t);
+void locals_destroy(Locals*);
+void locals_grow(Locals*, uint32_t);
 
-int memory_write(Memory*, uint32_t, uint32_t, size_t);
-int memory_read(Memory*, uint32_t, uint32_t*, size_t);
-int memory_expand(Memory*, size_t);
+static inline uint32_t locals_base(const Locals *locals) {
+    return (uint32_t) (locals->frame - locals->slots);
+}
+
+static inline void locals_enter(Locals *locals, uint32_t size) {
+    uint32_t base = locals->top;
+    if ((size_t) base + locals->window > locals->capacity) locals_grow(locals, base);
+    locals->frame = locals->slots + base;
+    locals->top = base + size;
+}
+
+// Back to the caller's window
+static inline void locals_leave(Locals *locals, uint32_t caller_base) {
+    locals->top = locals_base(locals);
+    locals->frame = locals->slots + caller_base;
+}
 
 void heap_init(Heap*);
 void heap_destroy(Heap*);
 
 size_t heap_add_block(Heap*, DataType);
+int heap_reserve(Heap*, size_t, size_t);
 size_t duplicate_heap_block(Heap*, size_t, DataType, int);
-int heap_write(Heap*, size_t, uint32_t, size_t, size_t);
-int heap_read(Heap*, size_t, uint32_t*, size_t, size_t);
-int heap_remove_element(Heap*, size_t, size_t, size_t);
\ No newline at end of file
+uint64_t convert_raw(uint64_t, DataType, DataType);
+int heap_write(Heap*, size_t, uint64_t, size_t, size_t);
+int heap_read(Heap*, size_t, uint64_t*, size_t, size_t);
+int heap_remove_element(Heap*, size_t, size_t, size_t);
+
+int heap_copy(Heap*, size_t, size_t, size_t, size_t, size_t);
+int heap_fill(Heap*, size_t, size_t, const void*, size_t);
+int heap_resize(Heap*, size_t, size_t);
+uint8_t *heap_span(Heap*, size_t, size_t*);
+
+size_t heap_concat(Heap*, size_t, size_t, DataType);
+void heap_flatten(Heap*, size_t);
+
+size_t heap_share(Heap*, size_t, DataType);
+// Drops what a block being swept holds on others: a view's source, a rope's halves
+void heap_unlink(Heap*, size_t);
+
+// LOAD_CONST pushes interned blocks without copying them. A value stored
+// where the program can modify it (a variable, a list element) gets its own
+// copy-on-write header first, so the constant itself is never written.
+static inline Item heap_own(Heap *heap, Item item) {
+    if (HAS_TAG(item, ARRAY_TYPE) && heap->blocks[ITEM_BITS(item)].flags & BLOCK_CONST)
+        return BOX(ARRAY_TYPE, heap_share(heap, ITEM_BITS(item), heap->blocks[ITEM_BITS(item)].type));
+    return item;
+}
\ No newline at end of file
@@ -4,16 +4,36 @@
 #include "syscall.h"
 
 typedef void (*OpcodeHandler)(VM*, Instruction);
+extern OpcodeHandler opcode_handlers[256];
+void grow_frames(VM*);
 void run_function(VM*, uint32_t);
 
+// A call frame remembers where to return and the caller's local window
+static inline void frame_push(VM *vm, Instruction *return_address) {
+    if (vm->frame_pointer == vm->frame_capacity) grow_frames(vm);
+    vm->frames[vm->frame_pointer++] = (Frame) { return_address, locals_base(&vm->locals) };
+}
+
+static inline Instruction *frame_pop(VM *vm) {
+    Frame *frame = &vm->frames[--vm->frame_pointer];
+    locals_leave(&vm->locals, frame->local_base);
+    return frame->return_address;
+}
+
 void handle_store(VM*, Instruction);
 void handle_store_byte(VM*, Instruction);
 void handle_store_float(VM*, Instruction);
 void handle_store_mem(VM*, Instruction);
 void handle_load(VM*, Instruction);
+void handle_load_const(VM*, Instruction);
+void handle_load_local(VM*, Instruction);
+void handle_store_local(VM*, Instruction);
+void handle_enter(VM*, Instruction);
 void handle_jump(VM*, Instruction);
 void handle_jump_if(VM*, Instruction);
 void handle_call(VM*, Instruction);
+void handle_call_direct(VM*, Instruction);
+void handle_tail_call(VM*, Instruction);
 void handle_return(VM*, Instruction);
 void handle_build_list(VM*, Instruction);
 void handle_list_access(VM*, Instruction);
@@ -22,5 +42,12 @@ void handle_store_char(VM*, Instruction);
 void handle_define_type(VM*, Instruction);
 void handle_new(VM*, Instruction);
 void handle_cast(VM*, Instruction);
+void handle_globals(VM*, Instruction);
+void handle_typed_alu(VM*, Instruction);
+void handle_concat(VM*, Instruction);
+void handle_inc_mem(VM*, Instruction);
+void handle_load_load_add(VM*, Instruction);
+void handle_cmp_jump_if_false(VM*, Instruction);
+void handle_load_const_add(VM*, Instruction);
 void handle_objcall(VM*, Instruction);
 void handle_syscall(VM*, Instruction);
@@ -0,0 +1,77 @@
+#pragma once
+
+// Must stay in sync with `opcodes` in compiler/utils/utils.py
+typedef enum {
+    OP_HALT         = 0x00, // VM internal: sentinel placed after the last instruction
+    OP_ADD          = 0x01,
+    OP_SUB          = 0x02,
+    OP_MUL          = 0x03,
+    OP_DIV          = 0x04,
+    OP_MOD          = 0x05,
+    OP_AND          = 0x06,
+    OP_OR           = 0x07,
+    OP_NOT          = 0x08,
+    OP_EQ           = 0x09,
+    OP_NEQ          = 0x0A,
+    OP_LT           = 0x0B,
+    OP_GT           = 0x0C,
+    OP_LE           = 0x0D,
+    OP_GE           = 0x0E,
+    OP_STORE        = 0x0F,
+    OP_STORE_BYTE   = 0x10,
+    OP_STORE_FLOAT  = 0x11,
+    OP_STORE_CHAR   = 0x12,
+    OP_STORE_MEM    = 0x13,
+    OP_LOAD         = 0x14,
+    OP_JUMP         = 0x15,
+    OP_JUMP_IF      = 0x16,
+    OP_CALL         = 0x17,
+    OP_RETURN       = 0x18,
+    OP_BUILD_LIST   = 0x19,
+    OP_LIST_ACCESS  = 0x1A,
+    OP_LIST_SET     = 0x1B,
+    OP_DEFINE_TYPE  = 0x1C,
+    OP_NEW          = 0x1D,
+    OP_CAST         = 0x1E,
+    OP_GLOBALS      = 0x1F, // First instruction: number of global slots
+
+    // Typed variants emitted when the compiler knows the operand types
+    OP_ADD_I        = 0x20,
+    OP_SUB_I        = 0x21,
+    OP_MUL_I        = 0x22,
+    OP_DIV_I        = 0x23,
+    OP_MOD_I        = 0x24,
+    OP_ADD_F        = 0x25,
+    OP_SUB_F        = 0x26,
+    OP_MUL_F        = 0x27,
+    OP_DIV_F        = 0x28,
+    OP_MOD_F        = 0x29,
+    OP_EQ_I         = 0x2A,
+    OP_NEQ_I        = 0x2B,
+    OP_LT_I         = 0x2C,
+    OP_GT_I         = 0x2D,
+    OP_LE_I         = 0x2E,
+    OP_GE_I         = 0x2F,
+    OP_EQ_F         = 0x30,
+    OP_NEQ_F        = 0x31,
+    OP_LT_F         = 0x32,
+    OP_GT_F         = 0x33,
+    OP_LE_F         = 0x34,
+    OP_GE_F         = 0x35,
+    OP_CONCAT       = 0x36,
+    OP_LOAD_CONST   = 0x37, // arg: constant pool index
+    OP_CALL_DIRECT  = 0x38, // arg: function start, checked by the loader
+    OP_TAIL_CALL    = 0x39, // CALL_DIRECT reusing the caller's frame
+    OP_LOAD_LOCAL   = 0x3A, // arg: slot in the running function's window
+    OP_STORE_LOCAL  = 0x3B,
+    OP_ENTER        = 0x3C, // First instruction of a function, arg: its local slots
+
+    // Superinstructions produced by the compiler peephole pass (-O)
+    OP_INC_MEM      = 0x40,
+    OP_LOAD_LOAD_ADD = 0x41, // arg: (address_a << 16) | address_b
+    OP_CMP_JUMP_IF_FALSE = 0x42, // arg: (typed comparison opcode << 24) | target
+    OP_LOAD_CONST_ADD = 0x43,
+
+    OP_OBJCALL      = 0xFE,
+    OP_SYSCALL      = 0xFF
+} Opcode;
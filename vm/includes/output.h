@@ -0,0 +1,34 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define OUTPUT_DEFAULT_BUFFER (64 * 1024)
+
+// Program output is collected in a VM-owned buffer and written out when it
+// fills up, before reading from stdin, on errors and at exit
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int unbuffered;      // Flush after every print, for interactive use
+    FILE *file;
+} Output;
+
+void output_init(Output*, FILE*, size_t capacity, int unbuffered);
+void output_destroy(Output*);
+void output_flush(Output*);
+void output_flush_all(void);
+
+void output_write(Output*, const void*, size_t);
+void output_int(Output*, int64_t);
+void output_float(Output*, double);
+
+static inline void output_char(Output *out, char c) {
+    if (out->size == out->capacity) output_flush(out);
+    out->data[out->size++] = c;
+}
+
+// Formatters shared with string concatenation, `buffer` needs 32 bytes
+size_t format_int(char *buffer, int64_t value);
+size_t format_float(char *buffer, double value);
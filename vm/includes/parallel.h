@@ -0,0 +1,20 @@
+#pragma once
+#include "../virtual_machine.h"
+
+// map and filter with --threads N split arrays of at least this many
+// elements across N threads, the caller's included
+#define PARALLEL_MIN_ELEMENTS 4096
+
+// Worker threads, each running the callee on its own VM: own operand stack,
+// frames and local windows over the caller's bytecode, constants and globals.
+// Only pure functions run there, so nothing writes the shared state.
+typedef struct Pool Pool;
+
+void pool_destroy(Pool*);
+
+// Calls the function at `function` on every element of the array block at
+// `address`, results[i] receiving the result for element i. Returns 0
+// without calling anything when it has to run on the caller's thread
+// instead: one thread, --profile, a small array, elements that aren't
+// scalars or a function that isn't pure.
+int parallel_apply(VM*, uint32_t function, size_t address, Item *results);
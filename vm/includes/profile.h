@@ -0,0 +1,41 @@
+#pragma once
+#include "strucs-type.h"
+#include <stdio.h>
+#include <stddef.h>
+
+#define PROFILE_DEFAULT_OUTPUT "profile.json"
+
+typedef struct {
+    uint32_t target;
+    double start;
+    double callees;           // Time spent in functions called from this one
+} ProfileFrame;
+
+// Execution counters for `vml --profile`. The dispatch loop calls
+// profile_step before every instruction, branches, calls and returns are
+// recognised from the instruction executed just before.
+typedef struct {
+    size_t size;              // Bytecode offsets covered, the HALT sentinel included
+    uint64_t *counts;         // Executions per bytecode offset
+    uint64_t *back_edges;     // Taken backward jumps per jump offset
+    uint64_t *calls;          // Calls per CALL target
+    double *total_ms;         // Time inside each function, callees included
+    double *self_ms;
+
+    ProfileFrame *frames;
+    size_t depth;
+    size_t frame_capacity;
+
+    uint32_t previous;
+    uint8_t previous_opcode;
+    double start;
+    double elapsed;
+    const char *output;       // Machine-readable report, written by profile_report
+} Profile;
+
+void profile_init(Profile*, size_t size, const char *output);
+void profile_destroy(Profile*);
+void profile_step(Profile*, uint32_t offset, uint8_t opcode);
+void profile_finish(Profile*);
+void profile_report(const Profile*, const Instruction*, FILE*);
+const char *opcode_name(uint8_t opcode);   // Mnemonic, "UNKNOWN" for unused opcodes
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+
+// Size classes of 8, 16, ... 512 bytes, carved out of SLAB_PAGE_SIZE pages.
+// Larger payloads go straight to the system allocator.
+#define SLAB_MIN_SHIFT 3
+#define SLAB_CLASSES 7
+#define SLAB_MAX_SIZE (1 << (SLAB_MIN_SHIFT + SLAB_CLASSES - 1))
+#define SLAB_PAGE_SIZE (64 * 1024)
+
+typedef struct {
+    size_t slab_allocs;    // Chunks handed out from a size class
+    size_t large_allocs;   // Payloads above SLAB_MAX_SIZE
+    size_t system_allocs;  // Calls into malloc/realloc: pages plus large payloads
+    size_t frees;
+    size_t pages;
+} SlabStats;
+
+typedef struct SlabChunk SlabChunk;
+
+// One heap's free lists and the pages they were carved out of, all zero
+// when empty
+typedef struct {
+    SlabChunk *free_chunks[SLAB_CLASSES];
+    void **pages;
+    size_t page_capacity;
+    SlabStats stats;
+} Slab;
+
+void *slab_alloc(Slab*, size_t size, size_t *capacity);
+void *slab_resize(Slab*, void *data, size_t used, size_t old_capacity, size_t size, size_t *capacity);
+void slab_free(Slab*, void *data, size_t capacity);
+void slab_release(Slab*);
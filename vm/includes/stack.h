@@ -3,14 +3,52 @@
 #include "errors.h"
 
 #define STACK_SIZE 1024
-int string_format;
+extern int string_format;
 
-// Method: Tagged Struct - To see later: NaN-Boxing
-typedef struct {
-    DataType type;
-    uint32_t value;
-} Item;
+// Method: NaN-Boxing. A FLOAT is a plain IEEE double, every other type lives
+// in the negative quiet-NaN space: sign | qnan | tag (3 bits) | 48-bit payload.
+// INT payloads are 48-bit two's complement, ARRAY payloads are heap indices.
+typedef uint64_t Item;
+
+#define BOX_MASK      0xFFF8000000000000ULL
+#define PAYLOAD_MASK  0x0000FFFFFFFFFFFFULL
+#define CANONICAL_NAN 0x7FF8000000000000ULL
+
+#define BOX(type, payload) (BOX_MASK | ((uint64_t) (type) << 48) | ((uint64_t) (payload) & PAYLOAD_MASK))
+
+#define IS_FLOAT(item)       (((item) & BOX_MASK) != BOX_MASK)
+#define HAS_TAG(item, type)  (((item) >> 48) == (BOX(type, 0) >> 48))
+#define ITEM_TYPE(item)      item_type(item)
+#define ITEM_BITS(item)      ((item) & PAYLOAD_MASK)
+#define AS_INT(item)         ((int64_t) ((item) << 16) >> 16)
+#define AS_FLOAT(item)       (((DoubleBits) { .bits = (item) }).value)
+#define AS_BOOL(item)        item_as_bool(item)
+#define FROM_INT(value)      BOX(INT_TYPE, value)
+#define FROM_FLOAT(value)    item_from_float(value)
+
+typedef union {
+    uint64_t bits;
+    double value;
+} DoubleBits;
+
+// Helpers that need their argument more than once are functions, so that
+// AS_BOOL(pop(stack)) pops a single item
+static inline DataType item_type(Item item) {
+    return IS_FLOAT(item) ? FLOAT_TYPE : (DataType) ((item >> 48) & 0x7);
+}
+
+static inline int item_as_bool(Item item) {
+    return IS_FLOAT(item) ? AS_FLOAT(item) != 0.0 : ITEM_BITS(item) != 0;
+}
+
+// A NaN produced by arithmetic must not be mistaken for a boxed value
+static inline Item item_from_float(double value) {
+    if (value != value) return CANONICAL_NAN;
+    return ((DoubleBits) { .value = value }).bits;
+}
 
+// data[0] is a sentinel so the interpreter can cache the top of the stack
+// in a register and spill it without special-casing an empty stack
 typedef struct {
     Item data[STACK_SIZE];
     int top;
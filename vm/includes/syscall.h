@@ -2,6 +2,7 @@
 
 #include "alu.h"
 #include "errors.h"
+#include "kernels.h"
 #include "stack.h"
 #include "strucs-type.h"
 
@@ -10,7 +11,7 @@
 #include <math.h>
 
 void syscall(VM *vm, int arg);
-void built_in_subprint(Item item, FILE *out);
+void built_in_subprint(Item item, Output *out);
 
 // System Functions
 void built_in_exit(VM*);
@@ -31,8 +32,18 @@ void built_in_is_empty(VM*);
 void built_in_map(VM*);
 void built_in_slice(VM*);
 void built_in_filter(VM*);
+void built_in_reduce(VM*);
 void built_in_min(VM*);
 void built_in_max(VM*);
 void built_in_lower(VM*);
 void built_in_upper(VM*);
-void built_in_toString(VM*);
\ No newline at end of file
+void built_in_toString(VM*);
+
+// Numeric array functions, see kernels.h
+void built_in_sum(VM*);
+void built_in_mean(VM*);
+void built_in_dot(VM*);
+void built_in_argmin(VM*);
+void built_in_argmax(VM*);
+void built_in_vec_add(VM*);
+void built_in_vec_mul(VM*);
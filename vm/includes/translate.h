@@ -0,0 +1,8 @@
+#pragma once
+#include "../virtual_machine.h"
+
+// Ahead-of-time translation (`vml --emit-c`): writes the loaded program as a
+// C translation unit with one label per instruction. Built against the VM
+// runtime library (`make aot`), it runs the program natively with the same
+// output as vml.
+void emit_c(const VM*, const char *program, const char *output);
@@ -18,47 +18,39 @@ Item logic_unit(Stack *stack, uint8_t op) {
     right = pop(stack);
     
     if (op == 0x08) // NOT OPERATOR
-        return (Item) { BOOL_TYPE, !right.value };
+        return BOX(BOOL_TYPE, !AS_BOOL(right));
     
     left = pop(stack);
     uint32_t value = (op == 0x06) ? // AND or OR OPERATORS
-        (left.value && right.value) : (left.value || right.value);
+        (AS_BOOL(left) && AS_BOOL(right)) : (AS_BOOL(left) || AS_BOOL(right));
 
-    return (Item) { BOOL_TYPE, value };
+    return BOX(BOOL_TYPE, value);
 }
 
 Item aritmetic_unit(Stack *stack, uint8_t op) {
-    Item result, left, right;
+    Item left, right;
     right = pop(stack); left = pop(stack);
-    int requires_float = left.type == FLOAT_TYPE || right.type == FLOAT_TYPE;
-    int div_mod_op = op == 0x04 || op == 0x05;
+    int requires_float = IS_FLOAT(left) || IS_FLOAT(right);
+    // Divisions of two INTs give INTs like DIV_I and MOD_I, any other on floats
+    int div_mod_op = (op == 0x04 || op == 0x05) && !(HAS_TAG(left, INT_TYPE) && HAS_TAG(right, INT_TYPE));
 
-    if (left.type == ARRAY_TYPE || right.type == ARRAY_TYPE) {
+    if (HAS_TAG(left, ARRAY_TYPE) || HAS_TAG(right, ARRAY_TYPE)) {
         push(stack, left);
         push(stack, right);
         string_format = 1;
 
-        return (Item) {
-            UNASSIGNED_TYPE,
-            -1
-        };
+        return BOX(UNASSIGNED_TYPE, -1);
     }
 
     if (requires_float || div_mod_op)
-        return (Item) {
-            FLOAT_TYPE,
-            format_float(float_alu(left, right, op))
-        };
+        return FROM_FLOAT(float_alu(left, right, op));
     
-    return (Item) {
-        INT_TYPE,
-        int_alu(left, right, op)
-    };
+    return FROM_INT(int_alu(left, right, op));
 }
 
-float float_alu(Item left, Item right, uint8_t op) {
-    float left_float = extract_float(left);
-    float right_float = extract_float(right);
+double float_alu(Item left, Item right, uint8_t op) {
+    double left_float = extract_float(left);
+    double right_float = extract_float(right);
 
     switch (op) {
         case 0x01: // ADD
@@ -88,42 +80,108 @@ float float_alu(Item left, Item right, uint8_t op) {
     return 0;
 }
 
-uint32_t int_alu(Item left, Item right, uint8_t op) {
+int64_t int_alu(Item left, Item right, uint8_t op) {
+    int64_t l = AS_INT(left), r = AS_INT(right);
+
     switch (op) {
         case 0x01: // ADD
-            return left.value + right.value;
+            return (uint64_t) l + (uint64_t) r;
         case 0x02: // SUB
-            return left.value - right.value;
+            return (uint64_t) l - (uint64_t) r;
         case 0x03: // MUL
-            return left.value * right.value;
+            return (uint64_t) l * (uint64_t) r;
+        case 0x04: // DIV
+            return int_div(l, r);
+        case 0x05: // MOD
+            return int_mod(l, r);
         case 0x09: // EQ
-            return left.value == right.value;
+            return l == r;
         case 0x0A: // NEQ
-            return left.value != right.value;
+            return l != r;
         case 0x0B: // LT
-            return (int) left.value < (int) right.value;
+            return l < r;
         case 0x0C: // GT
-            return (int) left.value > (int) right.value;
+            return l > r;
         case 0x0D: // LE
-            return (int) left.value <= (int) right.value;
+            return l <= r;
         case 0x0E: // GE
-            return (int) left.value >= (int) right.value;
+            return l >= r;
     }
 
     return 0;
 }
 
-uint32_t format_float(float value) {
-    return *((uint32_t*) &(value));
+// Typed opcodes (OP_ADD_I ... OP_GE_F): operand tags were checked by the compiler
+Item typed_alu(Item left, Item right, uint8_t op) {
+#ifdef VM_DEBUG
+    int float_op = op >= OP_ADD_F && op <= OP_MOD_F || op >= OP_EQ_F && op <= OP_GE_F;
+    if (float_op && (!IS_FLOAT(left) || !IS_FLOAT(right)))
+        handle_error(OPERAND_TYPE_MISMATCH);
+    if (!float_op && (!IS_INT_OPERAND(ITEM_TYPE(left)) || !IS_INT_OPERAND(ITEM_TYPE(right))))
+        handle_error(OPERAND_TYPE_MISMATCH);
+#endif
+    int64_t l = AS_INT(left), r = AS_INT(right);
+    double lf = AS_FLOAT(left), rf = AS_FLOAT(right);
+
+    switch (op) {
+        case OP_ADD_I: return FROM_INT((uint64_t) l + (uint64_t) r);
+        case OP_SUB_I: return FROM_INT((uint64_t) l - (uint64_t) r);
+        case OP_MUL_I: return FROM_INT((uint64_t) l * (uint64_t) r);
+        case OP_DIV_I: return FROM_INT(int_div(l, r));
+        case OP_MOD_I: return FROM_INT(int_mod(l, r));
+        case OP_ADD_F: return FROM_FLOAT(lf + rf);
+        case OP_SUB_F: return FROM_FLOAT(lf - rf);
+        case OP_MUL_F: return FROM_FLOAT(lf * rf);
+        case OP_DIV_F: return FROM_FLOAT(lf / rf);
+        case OP_MOD_F: return FROM_FLOAT(float_mod(lf, rf));
+        case OP_EQ_I:  return BOX(BOOL_TYPE, l == r);
+        case OP_NEQ_I: return BOX(BOOL_TYPE, l != r);
+        case OP_LT_I:  return BOX(BOOL_TYPE, l < r);
+        case OP_GT_I:  return BOX(BOOL_TYPE, l > r);
+        case OP_LE_I:  return BOX(BOOL_TYPE, l <= r);
+        case OP_GE_I:  return BOX(BOOL_TYPE, l >= r);
+        case OP_EQ_F:  return BOX(BOOL_TYPE, lf == rf);
+        case OP_NEQ_F: return BOX(BOOL_TYPE, lf != rf);
+        case OP_LT_F:  return BOX(BOOL_TYPE, lf < rf);
+        case OP_GT_F:  return BOX(BOOL_TYPE, lf > rf);
+        case OP_LE_F:  return BOX(BOOL_TYPE, lf <= rf);
+        case OP_GE_F:  return BOX(BOOL_TYPE, lf >= rf);
+    }
+
+    handle_error(UNDEFINED_ERROR);
+    return BOX(UNASSIGNED_TYPE, 0);
 }
 
-float extract_float(Item item) {
-    if (item.type == FLOAT_TYPE)
-        return *((float*)&item.value);
+// Rounds towards negative infinity like float_mod, so that
+// a == int_div(a, b) * b + int_mod(a, b). 48-bit operands can't overflow.
+int64_t int_div(int64_t a, int64_t b) {
+    if (b == 0) handle_error(DIVISION_BY_ZERO);
+    int64_t quotient = a / b;
+    if (quotient * b != a && (a < 0) != (b < 0)) quotient--;
+    return quotient;
+}
+
+// Same sign convention as float_mod: the result takes the sign of the divisor
+int64_t int_mod(int64_t a, int64_t b) {
+    if (b == 0) handle_error(DIVISION_BY_ZERO);
+    int64_t result = a % b;
+    if (result != 0 && (result < 0) != (b < 0)) result += b;
+    return result;
+}
 
-    return (float) ((int) item.value);
+// STORE_FLOAT literals are encoded by the compiler as 32-bit floats
+double float_from_bits(uint32_t bits) {
+    union { uint32_t bits; float value; } literal = { .bits = bits };
+    return literal.value;
 }
 
-float float_mod(float a, float b) {
-    return a - b * floorf(a / b);
-}
\ No newline at end of file
+double extract_float(Item item) {
+    if (IS_FLOAT(item))
+        return AS_FLOAT(item);
+
+    return (double) AS_INT(item);
+}
+
+double float_mod(double a, double b) {
+    return a - b * floor(a / b);
+}
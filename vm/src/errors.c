@@ -1,4 +1,7 @@
 #include "../includes/errors.h"
+#include "../includes/output.h"
+
+_Thread_local const uint8_t *instr_pc_log;
 
 char* error_messages[ERR_COUNT] = {
     "\033[1;35mFileNotFound:\033[0m unable to locate the specified file.",
@@ -11,10 +14,14 @@ char* error_messages[ERR_COUNT] = {
     "\033[1;35mFileOpenError:\033[0m failed to open the file, please check file permissions or path validity.",
     "\033[1;35mUnsupportedSerialization:\033[0m attempted to serialize a complex data structure in an unsupported format.",
     "\033[1;35mBinaryWriteError:\033[0m attempted to write a complex data structure to a binary file, which is not permitted.",
+    "\033[1;35mZeroDivision:\033[0m integer division or modulo by zero.",
+    "\033[1;35mOperandTypeMismatch:\033[0m a typed instruction received an operand of an unexpected type.",
+    "\033[1;35mInvalidBytecode:\033[0m the program is truncated or has an unknown opcode or an out-of-range operand.",
     "\033[1;35mUnknownError:\033[0m an unexpected error occurred, please check the logs for more details."
 };
 
 void handle_error(ErrorCode code) {
-    printf("\n\033[1;31m!\033[0m %s (Instruction: %d)\n", error_messages[code], instr_pc_log);
+    output_flush_all();
+    printf("\n\033[1;31m!\033[0m %s (Instruction: %d)\n", error_messages[code], instr_pc_log ? *instr_pc_log : 0);
     exit(EXIT_FAILURE);
 }
\ No newline at end of file
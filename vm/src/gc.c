@@ -0,0 +1,153 @@
+#include "../includes/gc.h"
+#include <time.h>
+#include <sys/resource.h>
+
+// Mark-sweep collector. Roots are the operand stack, the global slots and
+// the local windows of the active calls. Blocks of ARRAY_TYPE store the
+// indices of their child blocks, rope nodes their two halves. Both are traced
+// through an explicit worklist so deep nesting can't overflow the C stack.
+
+void gc_configure(Heap *heap, size_t threshold, double growth) {
+    heap->gc.min_threshold = threshold;
+    heap->gc.threshold = threshold;
+    heap->gc.growth = growth;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void mark_block(Heap *heap, size_t index, size_t *worklist, size_t *count) {
+    if (index >= heap->size || heap->blocks[index].flags & (BLOCK_MARKED | BLOCK_FREE)) return;
+
+    heap->blocks[index].flags |= BLOCK_MARKED;
+    worklist[(*count)++] = index;
+}
+
+static void mark_item(Heap *heap, Item item, size_t *worklist, size_t *count) {
+    if (HAS_TAG(item, ARRAY_TYPE)) mark_block(heap, ITEM_BITS(item), worklist, count);
+}
+
+static void mark(VM *vm) {
+    Heap *heap = &vm->heap;
+    size_t count = 0;
+    size_t *worklist = malloc(sizeof(size_t) * (heap->size ? heap->size : 1));
+    if (!worklist) handle_error(UNDEFINED_ERROR);
+
+    for (int i = 1; i <= vm->stack.top; i++)
+        mark_item(heap, vm->stack.data[i], worklist, &count);
+
+    for (size_t i = 0; i < vm->globals.size; i++)
+        mark_item(heap, vm->globals.slots[i], worklist, &count);
+
+    for (uint32_t i = 0; i < vm->locals.top; i++)
+        mark_item(heap, vm->locals.slots[i], worklist, &count);
+
+    while (count > 0) {
+        size_t index = worklist[--count];
+
+        if (heap->blocks[index].flags & BLOCK_ROPE) {
+            RopeNode *node = (RopeNode*) heap->blocks[index].data;
+            mark_block(heap, node->left, worklist, &count);
+            mark_block(heap, node->right, worklist, &count);
+            continue;
+        }
+
+        if (heap->blocks[index].flags & BLOCK_VIEW)
+            mark_block(heap, heap->blocks[index].source, worklist, &count);
+
+        if (heap->blocks[index].type != ARRAY_TYPE) continue;
+
+        Memory *block = &heap->blocks[index];
+        size_t child_size = sizes[ARRAY_TYPE];
+        for (size_t offset = 0; offset + child_size <= block->size; offset += child_size) {
+            uint64_t child;
+            memory_read(block, offset, &child, child_size);
+            mark_block(heap, child, worklist, &count);
+        }
+    }
+
+    free(worklist);
+}
+
+static void sweep(Heap *heap) {
+    for (size_t i = 0; i < heap->size; i++) {
+        if (heap->blocks[i].flags & BLOCK_FREE) continue;
+
+        if (heap->blocks[i].flags & (BLOCK_MARKED | BLOCK_CONST)) {
+            heap->blocks[i].flags &= ~BLOCK_MARKED;
+            continue;
+        }
+
+        heap_unlink(heap, i);
+        memory_destroy(&heap->slab, &heap->blocks[i]);
+        heap->blocks[i].flags = BLOCK_FREE;
+        heap->free_list[heap->free_count++] = i;
+        heap->gc.freed_blocks++;
+    }
+}
+
+// Only called at safe points of the dispatch loop, when every live value
+// is on the operand stack or in a global slot
+void gc_collect(VM *vm) {
+    Heap *heap = &vm->heap;
+    double start = now_ms();
+
+    size_t blocks = heap->size - heap->free_count;
+    if (blocks > heap->gc.peak_blocks) heap->gc.peak_blocks = blocks;
+
+    mark(vm);
+    sweep(heap);
+
+    size_t live = heap->size - heap->free_count;
+    size_t threshold = live * heap->gc.growth;
+    heap->gc.threshold = (threshold > heap->gc.min_threshold) ? threshold : heap->gc.min_threshold;
+    heap->gc.allocations = 0;
+    heap->gc.pending = 0;
+
+    double pause = now_ms() - start;
+    heap->gc.collections++;
+    heap->gc.total_pause += pause;
+    if (pause > heap->gc.max_pause) heap->gc.max_pause = pause;
+}
+
+// Peak resident set in KB. ru_maxrss keeps the high-water mark of the process
+// the VM was forked from, Linux's VmHWM starts over at exec.
+static long peak_rss_kb(void) {
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[128];
+        long kb = -1;
+        while (fgets(line, sizeof(line), status))
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+        fclose(status);
+        if (kb >= 0) return kb;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void gc_print_stats(const VM *vm, FILE *out) {
+    const Heap *heap = &vm->heap;
+    size_t live = heap->size - heap->free_count;
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < heap->size; i++)
+        if (!(heap->blocks[i].flags & BLOCK_FREE)) bytes += heap->blocks[i].capacity;
+
+    size_t peak = (live > heap->gc.peak_blocks) ? live : heap->gc.peak_blocks;
+
+    fprintf(out, "GC: %zu collections, %.3f ms total pause, %.3f ms max pause\n",
+        heap->gc.collections, heap->gc.total_pause, heap->gc.max_pause);
+    fprintf(out, "GC: %zu blocks freed, %zu live blocks (peak %zu), %zu heap bytes\n",
+        heap->gc.freed_blocks, live, peak, bytes);
+
+    const SlabStats *slab = &heap->slab.stats;
+
+    fprintf(out, "Allocator: %zu slab chunks, %zu large payloads, %zu system allocations (%zu pages), peak RSS %ld KB\n",
+        slab->slab_allocs, slab->large_allocs, slab->system_allocs, slab->pages, peak_rss_kb());
+}
@@ -0,0 +1,877 @@
+#include "../includes/jit.h"
+#include "../includes/opcodes.h"
+#include "../includes/alu.h"
+#include "../includes/opcode_handlers.h"
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+
+// Template JIT: a region of bytecode (a loop body, from the target of its
+// back edge to the back edge, or the start of a function) is translated one
+// instruction at a time into x86-64 that works on the VM stack in memory.
+// Jumps inside the region become native jumps. CALL and RETURN push and pop
+// VM frames themselves and continue natively when the destination is in the
+// region, ENTER and RETURN move the local window through the C helpers. Heap
+// opcodes, syscalls, jumps out of the region and failed type guards leave
+// through an exit stub that returns the offset of the instruction the
+// interpreter has to run next, with the stack exactly as it would have it.
+//
+// Registers: rbx = sp, r12 = globals, r13 = stack limit, r14 = stack base,
+// r15 = JitState, rbp = VM. All callee-saved, so C helpers can be called
+// directly.
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { XMM0, XMM1 };
+
+// Condition codes for jcc/setcc
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7,
+       CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+#define TAG_OF(type) (BOX(type, 0) >> 48)
+#define BOXED_TOP 0x1FFF         // item >> 51 for every boxed (non-FLOAT) item
+#define JIT_NEVER UINT32_MAX     // Counter of offsets that can't be compiled
+#define INSTRUCTION_SHIFT __builtin_ctz(sizeof(Instruction))
+
+_Static_assert((sizeof(Instruction) & (sizeof(Instruction) - 1)) == 0, "return addresses are converted with a shift");
+_Static_assert(sizeof(Frame) == 16, "frames are indexed with a shift");
+
+typedef enum {
+    FIXUP_LABEL,                 // rel32 to the code of a bytecode offset in the region
+    FIXUP_EXIT,                  // rel32 to the exit stub of a bytecode offset
+    FIXUP_DISPATCH,              // rel32 to the dynamic dispatch, offset in ecx
+    FIXUP_TABLE                  // imm64 address of the dispatch table
+} FixupKind;
+
+typedef struct {
+    uint32_t position;
+    uint32_t target;             // Bytecode offset
+    FixupKind kind;
+} Fixup;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+
+    Fixup *fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+
+    uint32_t start, end;         // Region, both inclusive
+    uint32_t *labels;            // Code position of each instruction of the region
+} Assembler;
+
+static void *grow(void *data, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) return data;
+    size_t new_capacity = *capacity ? *capacity * 2 : 256;
+    while (new_capacity < needed) new_capacity *= 2;
+
+    data = realloc(data, new_capacity * item);
+    if (!data) handle_error(UNDEFINED_ERROR);
+    *capacity = new_capacity;
+    return data;
+}
+
+static void emit8(Assembler *as, uint8_t byte) {
+    as->data = grow(as->data, &as->capacity, as->size + 1, 1);
+    as->data[as->size++] = byte;
+}
+
+static void emit32(Assembler *as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emit8(as, value >> (8 * i));
+}
+
+static void emit64(Assembler *as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emit8(as, value >> (8 * i));
+}
+
+static void patch32(Assembler *as, size_t position, uint32_t value) {
+    for (int i = 0; i < 4; i++) as->data[position + i] = value >> (8 * i);
+}
+
+// ---- Encoding ----
+
+static void rex(Assembler *as, int w, int reg, int rm) {
+    uint8_t prefix = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+    if (prefix != 0x40) emit8(as, prefix);
+}
+
+static void modrm_reg(Assembler *as, int reg, int rm) {
+    emit8(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void modrm_mem(Assembler *as, int reg, int base, int32_t disp) {
+    emit8(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emit8(as, 0x24);
+    emit32(as, disp);
+}
+
+static void mov_load(Assembler *as, int dst, int base, int32_t disp) {
+    rex(as, 1, dst, base); emit8(as, 0x8B); modrm_mem(as, dst, base, disp);
+}
+
+static void mov_store(Assembler *as, int base, int32_t disp, int src) {
+    rex(as, 1, src, base); emit8(as, 0x89); modrm_mem(as, src, base, disp);
+}
+
+// 32-bit forms, for the int fields of the VM
+static void mov32_load(Assembler *as, int dst, int base, int32_t disp) {
+    rex(as, 0, dst, base); emit8(as, 0x8B); modrm_mem(as, dst, base, disp);
+}
+
+static void cmp32_load(Assembler *as, int reg, int base, int32_t disp) {
+    rex(as, 0, reg, base); emit8(as, 0x3B); modrm_mem(as, reg, base, disp);
+}
+
+static void mov32_store(Assembler *as, int base, int32_t disp, int src) {
+    rex(as, 0, src, base); emit8(as, 0x89); modrm_mem(as, src, base, disp);
+}
+
+// ext: 0 add, 5 sub
+static void add32_mem(Assembler *as, int ext, int base, int32_t disp, int8_t value) {
+    rex(as, 0, 0, base); emit8(as, 0x83); modrm_mem(as, ext, base, disp); emit8(as, value);
+}
+
+static void mov_imm(Assembler *as, int dst, uint64_t value) {
+    rex(as, 1, 0, dst); emit8(as, 0xB8 + (dst & 7)); emit64(as, value);
+}
+
+static void lea(Assembler *as, int dst, int base, int32_t disp) {
+    rex(as, 1, dst, base); emit8(as, 0x8D); modrm_mem(as, dst, base, disp);
+}
+
+// op is the "r/m, reg" form: 0x01 add, 0x29 sub, 0x39 cmp, 0x21 and, 0x09 or, 0x85 test, 0x89 mov
+static void alu_rr(Assembler *as, uint8_t op, int dst, int src) {
+    rex(as, 1, src, dst); emit8(as, op); modrm_reg(as, src, dst);
+}
+
+// ext is the /digit: 0 add, 5 sub, 7 cmp
+static void alu_imm(Assembler *as, int ext, int dst, int32_t value) {
+    rex(as, 1, 0, dst); emit8(as, 0x81); modrm_reg(as, ext, dst); emit32(as, value);
+}
+
+// ext: 4 shl, 5 shr, 7 sar
+static void shift(Assembler *as, int ext, int dst, uint8_t count) {
+    rex(as, 1, 0, dst); emit8(as, 0xC1); modrm_reg(as, ext, dst); emit8(as, count);
+}
+
+static void imul(Assembler *as, int dst, int src) {
+    rex(as, 1, dst, src); emit8(as, 0x0F); emit8(as, 0xAF); modrm_reg(as, dst, src);
+}
+
+// setcc into one of al, cl, dl, bl
+static void setcc(Assembler *as, int cc, int reg) {
+    emit8(as, 0x0F); emit8(as, 0x90 + cc); modrm_reg(as, 0, reg);
+}
+
+// 8-bit "r/m, reg" form: 0x20 and, 0x08 or, 0x84 test
+static void alu8(Assembler *as, uint8_t op, int dst, int src) {
+    emit8(as, op); modrm_reg(as, src, dst);
+}
+
+static void movzx8(Assembler *as, int dst, int src) {
+    emit8(as, 0x0F); emit8(as, 0xB6); modrm_reg(as, dst, src);
+}
+
+static void call(Assembler *as, const void *function) {
+    mov_imm(as, RAX, (uint64_t) (uintptr_t) function);
+    emit8(as, 0xFF); modrm_reg(as, 2, RAX);
+}
+
+// movq xmm, [base + disp] / movq [base + disp], xmm
+static void movq_load(Assembler *as, int xmm, int base, int32_t disp) {
+    emit8(as, 0xF3); rex(as, 0, xmm, base); emit8(as, 0x0F); emit8(as, 0x7E); modrm_mem(as, xmm, base, disp);
+}
+
+static void movq_store(Assembler *as, int base, int32_t disp, int xmm) {
+    emit8(as, 0x66); rex(as, 0, xmm, base); emit8(as, 0x0F); emit8(as, 0xD6); modrm_mem(as, xmm, base, disp);
+}
+
+static void movq_from_gpr(Assembler *as, int xmm, int gpr) {
+    emit8(as, 0x66); rex(as, 1, xmm, gpr); emit8(as, 0x0F); emit8(as, 0x6E); modrm_reg(as, xmm, gpr);
+}
+
+// addsd 0x58, mulsd 0x59, subsd 0x5C, divsd 0x5E
+static void sse_sd(Assembler *as, uint8_t op, int dst, int src) {
+    emit8(as, 0xF2); emit8(as, 0x0F); emit8(as, op); modrm_reg(as, dst, src);
+}
+
+static void ucomisd(Assembler *as, int a, int b) {
+    emit8(as, 0x66); emit8(as, 0x0F); emit8(as, 0x2E); modrm_reg(as, a, b);
+}
+
+// ---- Control flow ----
+
+static void add_fixup(Assembler *as, uint32_t target, FixupKind kind) {
+    as->fixups = grow(as->fixups, &as->fixup_capacity, as->fixup_count + 1, sizeof(Fixup));
+    as->fixups[as->fixup_count++] = (Fixup) { as->size, target, kind };
+    if (kind == FIXUP_TABLE) emit64(as, 0);
+    else emit32(as, 0);
+}
+
+static int in_region(const Assembler *as, uint32_t target) {
+    return target >= as->start && target <= as->end;
+}
+
+// Native jump inside the region, exit to the interpreter otherwise
+static void jump_to(Assembler *as, int cc, uint32_t target) {
+    if (cc < 0) emit8(as, 0xE9);
+    else { emit8(as, 0x0F); emit8(as, 0x80 + cc); }
+    add_fixup(as, target, in_region(as, target) ? FIXUP_LABEL : FIXUP_EXIT);
+}
+
+// Forward jump inside the emitted code, bound with bind()
+static size_t jump_forward(Assembler *as, int cc) {
+    if (cc < 0) emit8(as, 0xE9);
+    else { emit8(as, 0x0F); emit8(as, 0x80 + cc); }
+    emit32(as, 0);
+    return as->size - 4;
+}
+
+static void bind(Assembler *as, size_t position) {
+    patch32(as, position, as->size - (position + 4));
+}
+
+static void exit_if(Assembler *as, int cc, uint32_t offset) {
+    if (cc < 0) emit8(as, 0xE9);
+    else { emit8(as, 0x0F); emit8(as, 0x80 + cc); }
+    add_fixup(as, offset, FIXUP_EXIT);
+}
+
+// Continues at the bytecode offset in ecx: natively inside the region,
+// through the epilogue otherwise
+static void dispatch(Assembler *as) {
+    emit8(as, 0xE9);
+    add_fixup(as, 0, FIXUP_DISPATCH);
+}
+
+// ---- Items ----
+
+// Fewer than n items: let the interpreter raise STACK_UNDERFLOW
+static void need(Assembler *as, int n, uint32_t offset) {
+    lea(as, RAX, R14, n * 8);
+    alu_rr(as, 0x39, RBX, RAX);
+    exit_if(as, CC_B, offset);
+}
+
+static void push_rax(Assembler *as, uint32_t offset) {
+    alu_rr(as, 0x39, RBX, R13);
+    exit_if(as, CC_AE, offset);
+    alu_imm(as, 0, RBX, 8);
+    mov_store(as, RBX, 0, RAX);
+}
+
+static void sign_extend(Assembler *as, int reg) {
+    shift(as, 4, reg, 16);
+    shift(as, 7, reg, 16);
+}
+
+// rax = BOX(type, rax)
+static void box(Assembler *as, DataType type) {
+    shift(as, 4, RAX, 16);
+    shift(as, 5, RAX, 16);
+    mov_imm(as, RDX, BOX(type, 0));
+    alu_rr(as, 0x09, RAX, RDX);
+}
+
+// rax = BOX(type, al)
+static void box_flag(Assembler *as, int flag, DataType type) {
+    movzx8(as, RAX, flag);
+    mov_imm(as, RDX, BOX(type, 0));
+    alu_rr(as, 0x09, RAX, RDX);
+}
+
+// Flags of comparing the tag of reg with tag
+static void compare_tag(Assembler *as, int reg, uint64_t tag) {
+    alu_rr(as, 0x89, RDX, reg);
+    shift(as, 5, RDX, 48);
+    alu_imm(as, 7, RDX, tag);
+}
+
+// FLOAT operands go back to the interpreter
+static void guard_boxed(Assembler *as, int reg, uint32_t offset) {
+    alu_rr(as, 0x89, RDX, reg);
+    shift(as, 5, RDX, 51);
+    alu_imm(as, 7, RDX, BOXED_TOP);
+    exit_if(as, CC_NE, offset);
+}
+
+// rax = left, rcx = right (both still on the stack)
+static void load_operands(Assembler *as, uint32_t offset) {
+    need(as, 2, offset);
+    mov_load(as, RAX, RBX, -8);
+    mov_load(as, RCX, RBX, 0);
+}
+
+// Replaces the two operands by rax
+static void store_result(Assembler *as) {
+    alu_imm(as, 5, RBX, 8);
+    mov_store(as, RBX, 0, RAX);
+}
+
+// NaN results are canonicalized like FROM_FLOAT does
+static void canonicalize_xmm0(Assembler *as) {
+    ucomisd(as, XMM0, XMM0);
+    emit8(as, 0x70 + CC_NP); emit8(as, 15);
+    mov_imm(as, RAX, CANONICAL_NAN);
+    movq_from_gpr(as, XMM0, RAX);
+}
+
+static int int_condition(uint8_t opcode) {
+    switch (opcode) {
+        case OP_EQ: case OP_EQ_I:   return CC_E;
+        case OP_NEQ: case OP_NEQ_I: return CC_NE;
+        case OP_LT: case OP_LT_I:   return CC_L;
+        case OP_GT: case OP_GT_I:   return CC_G;
+        case OP_LE: case OP_LE_I:   return CC_LE;
+        default:                    return CC_GE;
+    }
+}
+
+// al = l <op> r for sign-extended rax, rcx
+static void int_compare(Assembler *as, uint8_t opcode) {
+    alu_rr(as, 0x39, RAX, RCX);
+    setcc(as, int_condition(opcode), RAX);
+}
+
+// al = l <op> r for xmm0, xmm1, false when either is NaN (true for NEQ)
+static void float_compare(Assembler *as, uint8_t opcode) {
+    switch (opcode) {
+        case OP_GT_F: ucomisd(as, XMM0, XMM1); setcc(as, CC_A, RAX); break;
+        case OP_GE_F: ucomisd(as, XMM0, XMM1); setcc(as, CC_AE, RAX); break;
+        case OP_LT_F: ucomisd(as, XMM1, XMM0); setcc(as, CC_A, RAX); break;
+        case OP_LE_F: ucomisd(as, XMM1, XMM0); setcc(as, CC_AE, RAX); break;
+        case OP_EQ_F:
+            ucomisd(as, XMM0, XMM1); setcc(as, CC_E, RAX); setcc(as, CC_NP, RCX);
+            alu8(as, 0x20, RAX, RCX);
+            break;
+        default:
+            ucomisd(as, XMM0, XMM1); setcc(as, CC_NE, RAX); setcc(as, CC_P, RCX);
+            alu8(as, 0x08, RAX, RCX);
+            break;
+    }
+}
+
+static void load_float_operands(Assembler *as, uint32_t offset) {
+    need(as, 2, offset);
+    movq_load(as, XMM0, RBX, -8);
+    movq_load(as, XMM1, RBX, 0);
+}
+
+// Generic ALU opcodes on anything but arrays, like BINARY_OP and
+// DIVISION_OP compute them
+static Item generic_alu(Item left, Item right, uint8_t op) {
+    int int_division = HAS_TAG(left, INT_TYPE) && HAS_TAG(right, INT_TYPE);
+    if (IS_FLOAT(left) || IS_FLOAT(right) || ((op == OP_DIV || op == OP_MOD) && !int_division))
+        return FROM_FLOAT(float_alu(left, right, op));
+    return FROM_INT(int_alu(left, right, op));
+}
+
+#define LOCALS_FIELD(field) (offsetof(VM, locals) + offsetof(Locals, field))
+
+// eax = the running function's local base, see locals_base
+static void local_base(Assembler *as, int scratch) {
+    mov_load(as, RAX, RBP, LOCALS_FIELD(frame));
+    mov_load(as, scratch, RBP, LOCALS_FIELD(slots));
+    alu_rr(as, 0x29, RAX, scratch);
+    shift(as, 5, RAX, 3);
+}
+
+// frames[eax] = { the instruction after offset, local base }, frame_pointer++.
+// Leaves rcx alone, CALL keeps its destination there.
+static void push_frame(Assembler *as, uint32_t offset) {
+    mov_load(as, RDX, RBP, offsetof(VM, frames));
+    shift(as, 4, RAX, 4);
+    alu_rr(as, 0x01, RDX, RAX);
+    mov_load(as, RSI, RBP, offsetof(VM, bytecode));
+    alu_imm(as, 0, RSI, (offset + 1) * sizeof(Instruction));
+    mov_store(as, RDX, offsetof(Frame, return_address), RSI);
+    local_base(as, RSI);
+    mov32_store(as, RDX, offsetof(Frame, local_base), RAX);
+    add32_mem(as, 0, RBP, offsetof(VM, frame_pointer), 1);
+}
+
+// Emits one instruction. Returns 0 when it can't be compiled and has to run
+// in the interpreter.
+static int emit_instruction(Assembler *as, const VM *vm, Instruction instr, uint32_t offset) {
+    uint8_t op = instr.opcode;
+
+    switch (op) {
+        case OP_STORE:       mov_imm(as, RAX, FROM_INT((int32_t) instr.arg)); push_rax(as, offset); return 1;
+        case OP_STORE_BYTE:  mov_imm(as, RAX, BOX(BOOL_TYPE, instr.arg)); push_rax(as, offset); return 1;
+        case OP_STORE_CHAR:  mov_imm(as, RAX, BOX(CHAR_TYPE, instr.arg)); push_rax(as, offset); return 1;
+        case OP_STORE_FLOAT: mov_imm(as, RAX, FROM_FLOAT(float_from_bits(instr.arg))); push_rax(as, offset); return 1;
+        case OP_LOAD_CONST:  mov_imm(as, RAX, vm->constants[instr.arg]); push_rax(as, offset); return 1;
+
+        case OP_LOAD:
+            mov_load(as, RAX, R12, instr.arg * 8);
+            push_rax(as, offset);
+            return 1;
+
+        case OP_LOAD_LOCAL:
+            mov_load(as, RDX, RBP, LOCALS_FIELD(frame));
+            mov_load(as, RAX, RDX, instr.arg * 8);
+            push_rax(as, offset);
+            return 1;
+
+        case OP_STORE_LOCAL:
+            need(as, 1, offset);
+            mov_load(as, RAX, RBX, 0);
+            compare_tag(as, RAX, TAG_OF(ARRAY_TYPE));
+            exit_if(as, CC_E, offset);
+            mov_load(as, RDX, RBP, LOCALS_FIELD(frame));
+            mov_store(as, RDX, instr.arg * 8, RAX);
+            alu_imm(as, 5, RBX, 8);
+            return 1;
+
+        case OP_ENTER:
+            lea(as, RDI, RBP, offsetof(VM, locals));
+            emit8(as, 0xBE); emit32(as, instr.arg);                     // mov esi, size
+            call(as, (void*) locals_enter);
+            return 1;
+
+        // Arrays may be constants that need their own copy, see heap_own
+        case OP_STORE_MEM:
+            need(as, 1, offset);
+            mov_load(as, RAX, RBX, 0);
+            alu_rr(as, 0x89, RDX, RAX);
+            shift(as, 5, RDX, 48);
+            alu_imm(as, 7, RDX, TAG_OF(ARRAY_TYPE));
+            exit_if(as, CC_E, offset);
+            mov_store(as, R12, instr.arg * 8, RAX);
+            alu_imm(as, 5, RBX, 8);
+            return 1;
+
+        // Untyped: arrays are formatted by the interpreter, two INTs are
+        // computed inline and anything else goes through generic_alu
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_GT: case OP_LE: case OP_GE: {
+            load_operands(as, offset);
+            compare_tag(as, RAX, TAG_OF(ARRAY_TYPE));
+            exit_if(as, CC_E, offset);
+            compare_tag(as, RCX, TAG_OF(ARRAY_TYPE));
+            exit_if(as, CC_E, offset);
+
+            size_t done = 0, slow[2] = { 0 };
+            int inline_int = op != OP_DIV && op != OP_MOD;
+            if (inline_int) {
+                compare_tag(as, RAX, TAG_OF(INT_TYPE));
+                slow[0] = jump_forward(as, CC_NE);
+                compare_tag(as, RCX, TAG_OF(INT_TYPE));
+                slow[1] = jump_forward(as, CC_NE);
+                sign_extend(as, RAX);
+                sign_extend(as, RCX);
+                if (op == OP_ADD) alu_rr(as, 0x01, RAX, RCX);
+                else if (op == OP_SUB) alu_rr(as, 0x29, RAX, RCX);
+                else if (op == OP_MUL) imul(as, RAX, RCX);
+                else { int_compare(as, op); movzx8(as, RAX, RAX); }
+                box(as, INT_TYPE);
+                done = jump_forward(as, -1);
+                bind(as, slow[0]);
+                bind(as, slow[1]);
+            }
+            alu_rr(as, 0x89, RDI, RAX);
+            alu_rr(as, 0x89, RSI, RCX);
+            emit8(as, 0xBA); emit32(as, op);                            // mov edx, op
+            call(as, (void*) generic_alu);
+            if (inline_int) bind(as, done);
+            store_result(as);
+            return 1;
+        }
+
+        case OP_ADD_I: case OP_SUB_I: case OP_MUL_I:
+            load_operands(as, offset);
+            sign_extend(as, RAX);
+            sign_extend(as, RCX);
+            if (op == OP_ADD_I) alu_rr(as, 0x01, RAX, RCX);
+            else if (op == OP_SUB_I) alu_rr(as, 0x29, RAX, RCX);
+            else imul(as, RAX, RCX);
+            box(as, INT_TYPE);
+            store_result(as);
+            return 1;
+
+        // Division by zero is raised by the interpreter
+        case OP_DIV_I: case OP_MOD_I:
+            load_operands(as, offset);
+            sign_extend(as, RAX);
+            sign_extend(as, RCX);
+            alu_rr(as, 0x85, RCX, RCX);
+            exit_if(as, CC_E, offset);
+            alu_rr(as, 0x89, RDI, RAX);
+            alu_rr(as, 0x89, RSI, RCX);
+            call(as, op == OP_DIV_I ? (void*) int_div : (void*) int_mod);
+            box(as, INT_TYPE);
+            store_result(as);
+            return 1;
+
+        case OP_EQ_I: case OP_NEQ_I: case OP_LT_I: case OP_GT_I: case OP_LE_I: case OP_GE_I:
+            load_operands(as, offset);
+            sign_extend(as, RAX);
+            sign_extend(as, RCX);
+            int_compare(as, op);
+            box_flag(as, RAX, BOOL_TYPE);
+            store_result(as);
+            return 1;
+
+        case OP_ADD_F: case OP_SUB_F: case OP_MUL_F: case OP_DIV_F: case OP_MOD_F: {
+            static const uint8_t sse[] = { 0x58, 0x5C, 0x59, 0x5E };
+            load_float_operands(as, offset);
+            if (op == OP_MOD_F) call(as, (void*) float_mod);
+            else sse_sd(as, sse[op - OP_ADD_F], XMM0, XMM1);
+            canonicalize_xmm0(as);
+            alu_imm(as, 5, RBX, 8);
+            movq_store(as, RBX, 0, XMM0);
+            return 1;
+        }
+
+        case OP_EQ_F: case OP_NEQ_F: case OP_LT_F: case OP_GT_F: case OP_LE_F: case OP_GE_F:
+            load_float_operands(as, offset);
+            float_compare(as, op);
+            box_flag(as, RAX, BOOL_TYPE);
+            store_result(as);
+            return 1;
+
+        case OP_AND: case OP_OR:
+            load_operands(as, offset);
+            guard_boxed(as, RAX, offset);
+            guard_boxed(as, RCX, offset);
+            shift(as, 4, RAX, 16);
+            shift(as, 4, RCX, 16);
+            alu_rr(as, 0x85, RAX, RAX);
+            setcc(as, CC_NE, RDX);
+            alu_rr(as, 0x85, RCX, RCX);
+            setcc(as, CC_NE, RCX);
+            alu8(as, op == OP_AND ? 0x20 : 0x08, RDX, RCX);
+            box_flag(as, RDX, BOOL_TYPE);
+            store_result(as);
+            return 1;
+
+        case OP_NOT:
+            need(as, 1, offset);
+            mov_load(as, RAX, RBX, 0);
+            guard_boxed(as, RAX, offset);
+            shift(as, 4, RAX, 16);
+            alu_rr(as, 0x85, RAX, RAX);
+            setcc(as, CC_E, RAX);
+            box_flag(as, RAX, BOOL_TYPE);
+            mov_store(as, RBX, 0, RAX);
+            return 1;
+
+        case OP_INC_MEM:
+            mov_load(as, RAX, R12, instr.arg * 8);
+            sign_extend(as, RAX);
+            alu_imm(as, 0, RAX, 1);
+            box(as, INT_TYPE);
+            mov_store(as, R12, instr.arg * 8, RAX);
+            return 1;
+
+        case OP_LOAD_LOAD_ADD:
+            mov_load(as, RAX, R12, (instr.arg >> 16) * 8);
+            mov_load(as, RCX, R12, (instr.arg & 0xFFFF) * 8);
+            sign_extend(as, RAX);
+            sign_extend(as, RCX);
+            alu_rr(as, 0x01, RAX, RCX);
+            box(as, INT_TYPE);
+            push_rax(as, offset);
+            return 1;
+
+        case OP_LOAD_CONST_ADD:
+            need(as, 1, offset);
+            mov_load(as, RAX, RBX, 0);
+            sign_extend(as, RAX);
+            alu_imm(as, 0, RAX, (int32_t) instr.arg);
+            box(as, INT_TYPE);
+            mov_store(as, RBX, 0, RAX);
+            return 1;
+
+        case OP_JUMP:
+            jump_to(as, -1, instr.arg);
+            return 1;
+
+        case OP_JUMP_IF:
+            need(as, 1, offset);
+            mov_load(as, RAX, RBX, 0);
+            guard_boxed(as, RAX, offset);
+            alu_imm(as, 5, RBX, 8);
+            shift(as, 4, RAX, 16);
+            alu_rr(as, 0x85, RAX, RAX);
+            jump_to(as, CC_NE, instr.arg);
+            return 1;
+
+        case OP_CMP_JUMP_IF_FALSE: {
+            uint8_t compare = instr.arg >> 24;
+            if (compare < OP_EQ_I || compare > OP_GE_F) return 0;
+            if (compare >= OP_EQ_F) {
+                load_float_operands(as, offset);
+                float_compare(as, compare);
+            } else {
+                load_operands(as, offset);
+                sign_extend(as, RAX);
+                sign_extend(as, RCX);
+                int_compare(as, compare);
+            }
+            alu_imm(as, 5, RBX, 16);
+            alu8(as, 0x84, RAX, RAX);
+            jump_to(as, CC_E, instr.arg & 0xFFFFFF);
+            return 1;
+        }
+
+        // Frames are pushed and popped here, a full frame stack or a bad
+        // destination is left to the interpreter to grow or report
+        case OP_CALL:
+            if (instr.arg == (uint32_t) -1) {
+                need(as, 1, offset);
+                mov_load(as, RCX, RBX, 0);
+            } else {
+                mov_load(as, RCX, R12, instr.arg * 8);
+            }
+            rex(as, 0, RCX, RCX); emit8(as, 0x89); modrm_reg(as, RCX, RCX);    // mov ecx, ecx
+            alu_imm(as, 7, RCX, vm->program_size);
+            exit_if(as, CC_A, offset);
+            mov32_load(as, RAX, RBP, offsetof(VM, frame_pointer));
+            cmp32_load(as, RAX, RBP, offsetof(VM, frame_capacity));
+            exit_if(as, CC_E, offset);
+
+            if (instr.arg == (uint32_t) -1) alu_imm(as, 5, RBX, 8);
+            push_frame(as, offset);
+            dispatch(as);
+            return 1;
+
+        // Checked by the loader, the target is a plain jump
+        case OP_CALL_DIRECT:
+            mov32_load(as, RAX, RBP, offsetof(VM, frame_pointer));
+            cmp32_load(as, RAX, RBP, offsetof(VM, frame_capacity));
+            exit_if(as, CC_E, offset);
+            push_frame(as, offset);
+            jump_to(as, -1, instr.arg);
+            return 1;
+
+        // The callee's ENTER reopens the window at our base
+        case OP_TAIL_CALL:
+            local_base(as, RDX);
+            mov32_store(as, RBP, LOCALS_FIELD(top), RAX);
+            jump_to(as, -1, instr.arg);
+            return 1;
+
+        case OP_RETURN:
+            mov32_load(as, RAX, RBP, offsetof(VM, frame_pointer));
+            alu_rr(as, 0x85, RAX, RAX);
+            exit_if(as, CC_E, vm->program_size);
+            alu_rr(as, 0x89, RDI, RBP);
+            call(as, (void*) frame_pop);
+            alu_rr(as, 0x89, RCX, RAX);
+            mov_load(as, RAX, RBP, offsetof(VM, bytecode));
+            alu_rr(as, 0x29, RCX, RAX);
+            shift(as, 5, RCX, INSTRUCTION_SHIFT);
+            dispatch(as);
+            return 1;
+
+        case OP_GLOBALS: case OP_DEFINE_TYPE: case OP_NEW: case OP_OBJCALL:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+static void assembler_destroy(Assembler *as) {
+    free(as->data);
+    free(as->fixups);
+    free(as->labels);
+}
+
+// Compiles [start, end]. Returns NULL when the first instruction can't be
+// compiled, entering would only bounce back to the interpreter.
+static JitCode compile_region(Jit *jit, const VM *vm, uint32_t start, uint32_t end) {
+    if (start >= (uint32_t) vm->program_size) return NULL;
+    if (end - start >= JIT_MAX_REGION) end = start + JIT_MAX_REGION - 1;
+    if (end >= (uint32_t) vm->program_size) end = vm->program_size - 1;
+    uint32_t length = end - start + 1;
+
+    Assembler as = { 0 };
+    as.start = start;
+    as.end = end;
+    as.labels = malloc(sizeof(uint32_t) * length);
+    if (!as.labels) handle_error(UNDEFINED_ERROR);
+
+    // Prologue: six pushes and the padding keep rsp 16-byte aligned for calls
+    static const uint8_t saved[] = { RBP, RBX, R12, R13, R14, R15 };
+    for (int i = 0; i < 6; i++) { rex(&as, 0, 0, saved[i]); emit8(&as, 0x50 + (saved[i] & 7)); }
+    alu_imm(&as, 5, RSP, 8);
+    alu_rr(&as, 0x89, R15, RDI);
+    mov_load(&as, RBX, R15, offsetof(JitState, sp));
+    mov_load(&as, R12, R15, offsetof(JitState, globals));
+    mov_load(&as, R13, R15, offsetof(JitState, limit));
+    mov_load(&as, R14, R15, offsetof(JitState, base));
+    mov_load(&as, RBP, R15, offsetof(JitState, vm));
+
+    size_t compiled = 0;
+    for (uint32_t offset = start; offset <= end; offset++) {
+        as.labels[offset - start] = as.size;
+        if (emit_instruction(&as, vm, vm->bytecode[offset], offset)) {
+            compiled++;
+        } else {
+            if (offset == start) { assembler_destroy(&as); return NULL; }
+            exit_if(&as, -1, offset);
+        }
+    }
+    exit_if(&as, -1, end + 1);
+
+    // Exit stubs, one per resume offset: ecx = offset, then the epilogue
+    size_t fixup_count = as.fixup_count;
+    uint32_t *stub_offsets = malloc(sizeof(uint32_t) * (fixup_count + 1));
+    uint32_t *stub_positions = malloc(sizeof(uint32_t) * (fixup_count + 1));
+    if (!stub_offsets || !stub_positions) handle_error(UNDEFINED_ERROR);
+    size_t stub_count = 0;
+
+    for (size_t i = 0; i < fixup_count; i++) {
+        if (as.fixups[i].kind != FIXUP_EXIT) continue;
+
+        size_t stub = 0;
+        while (stub < stub_count && stub_offsets[stub] != as.fixups[i].target) stub++;
+        if (stub == stub_count) {
+            stub_offsets[stub_count] = as.fixups[i].target;
+            stub_positions[stub_count++] = as.size;
+            emit8(&as, 0xB9); emit32(&as, as.fixups[i].target);       // mov ecx, offset
+            emit8(&as, 0xE9); emit32(&as, 0);                          // jmp exit
+        }
+        as.fixups[i].target = stub;
+    }
+
+    // Dynamic dispatch: ecx = offset, jump through the table when it is
+    // inside the region, leave with it otherwise
+    size_t dispatch_position = as.size;
+    emit8(&as, 0x89); modrm_reg(&as, RCX, RAX);                        // mov eax, ecx
+    emit8(&as, 0x2D); emit32(&as, start);                              // sub eax, start
+    emit8(&as, 0x3D); emit32(&as, length);                             // cmp eax, length
+    emit8(&as, 0x73); emit8(&as, 13);                                  // jae exit
+    rex(&as, 1, 0, RDX); emit8(&as, 0xB8 + RDX);
+    add_fixup(&as, 0, FIXUP_TABLE);                                    // mov rdx, table
+    emit8(&as, 0xFF); emit8(&as, 0x24); emit8(&as, 0xC2);              // jmp [rdx + rax*8]
+
+    // Epilogue: the resume offset is returned in eax
+    size_t exit_position = as.size;
+    emit8(&as, 0x89); modrm_reg(&as, RCX, RAX);                        // mov eax, ecx
+    mov_store(&as, R15, offsetof(JitState, sp), RBX);
+    alu_imm(&as, 0, RSP, 8);
+    for (int i = 5; i >= 0; i--) { rex(&as, 0, 0, saved[i]); emit8(&as, 0x58 + (saved[i] & 7)); }
+    emit8(&as, 0xC3);
+
+    for (size_t stub = 0; stub < stub_count; stub++) {
+        size_t position = stub_positions[stub] + 6;
+        patch32(&as, position, exit_position - (position + 4));
+    }
+
+    for (size_t i = 0; i < fixup_count; i++) {
+        Fixup fixup = as.fixups[i];
+        size_t destination = 0;
+        switch (fixup.kind) {
+            case FIXUP_LABEL:    destination = as.labels[fixup.target - start]; break;
+            case FIXUP_EXIT:     destination = stub_positions[fixup.target]; break;
+            case FIXUP_DISPATCH: destination = dispatch_position; break;
+            case FIXUP_TABLE:    continue;
+        }
+        patch32(&as, fixup.position, destination - (fixup.position + 4));
+    }
+    free(stub_offsets);
+    free(stub_positions);
+
+    // The table of native addresses, one per instruction, follows the code
+    size_t table = (as.size + 7) & ~(size_t) 7;
+    size_t bytes = table + sizeof(uint64_t) * length;
+
+    uint8_t *code = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) { assembler_destroy(&as); return NULL; }
+    memcpy(code, as.data, as.size);
+
+    for (uint32_t i = 0; i < length; i++) {
+        uint64_t address = (uint64_t) (uintptr_t) (code + as.labels[i]);
+        memcpy(code + table + i * sizeof(uint64_t), &address, sizeof(uint64_t));
+    }
+    for (size_t i = as.fixup_count; i-- > 0;) {
+        if (as.fixups[i].kind != FIXUP_TABLE) continue;
+        uint64_t address = (uint64_t) (uintptr_t) (code + table);
+        memcpy(code + as.fixups[i].position, &address, sizeof(uint64_t));
+    }
+
+    if (mprotect(code, bytes, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, bytes);
+        assembler_destroy(&as);
+        return NULL;
+    }
+
+    jit->regions = grow(jit->regions, &jit->region_capacity, jit->region_count + 1, sizeof(JitRegion));
+    jit->regions[jit->region_count++] = (JitRegion) { code, bytes };
+    jit->code_bytes += bytes;
+    jit->compiled_instructions += compiled;
+
+    assembler_destroy(&as);
+    return (JitCode) (void*) code;
+}
+
+Jit *jit_create(const VM *vm, uint32_t threshold) {
+    Jit *jit = calloc(1, sizeof(Jit));
+    if (!jit) handle_error(UNDEFINED_ERROR);
+
+    jit->size = vm->program_size + 1;
+    jit->threshold = threshold;
+    jit->counters = calloc(jit->size, sizeof(uint32_t));
+    jit->entries = calloc(jit->size, sizeof(JitCode));
+    if (!jit->counters || !jit->entries) handle_error(UNDEFINED_ERROR);
+    return jit;
+}
+
+void jit_destroy(Jit *jit) {
+    if (!jit) return;
+    for (size_t i = 0; i < jit->region_count; i++)
+        munmap(jit->regions[i].code, jit->regions[i].bytes);
+
+    free(jit->regions);
+    free(jit->counters);
+    free(jit->entries);
+    free(jit);
+}
+
+static JitCode compile_entry(Jit *jit, const VM *vm, uint32_t offset, uint32_t end) {
+    JitCode code = compile_region(jit, vm, offset, end);
+    if (code) jit->entries[offset] = code;
+    else jit->counters[offset] = JIT_NEVER;
+    return code;
+}
+
+// Compiles the region at `offset` without waiting for it to get hot
+void jit_compile(VM *vm, uint32_t offset, uint32_t end) {
+    Jit *jit = vm->jit;
+    if (!jit->entries[offset] && jit->counters[offset] != JIT_NEVER) compile_entry(jit, vm, offset, end);
+}
+
+// Called by the interpreter when it reaches `offset` through a backward jump
+// from `end` or a call (end = offset + JIT_MAX_REGION - 1). Counts the entry,
+// compiles the region once it is hot and runs the compiled code if there is
+// any. The interpreter's state must be saved in vm, and is updated.
+void jit_enter(VM *vm, uint32_t offset, uint32_t end) {
+    Jit *jit = vm->jit;
+    JitCode code = jit->entries[offset];
+
+    if (!code) {
+        if (!jit->counters || jit->counters[offset] == JIT_NEVER || ++jit->counters[offset] < jit->threshold) return;
+        if (!(code = compile_entry(jit, vm, offset, end))) return;
+    }
+
+    JitState state = {
+        vm->stack.data + vm->stack.top, vm->globals.slots,
+        vm->stack.data + STACK_SIZE - 1, vm->stack.data, vm
+    };
+    uint32_t resume = code(&state);
+
+    jit->runs++;
+    vm->stack.top = (int) (state.sp - vm->stack.data);
+    vm->pc = vm->bytecode + resume;
+}
+
+void jit_print_stats(const Jit *jit, FILE *out) {
+    fprintf(out, "JIT: %zu regions, %zu instructions compiled into %zu bytes, %llu entries\n",
+        jit->region_count, jit->compiled_instructions, jit->code_bytes, (unsigned long long) jit->runs);
+}
+
+#endif
@@ -0,0 +1,436 @@
+#include "../includes/kernels.h"
+#include "../includes/stack.h"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KERNELS_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Flipping bit 47 maps the signed payloads onto [0, 2^48) in the same order,
+// and adding them to 2^52 as the mantissa turns them into exact doubles, so
+// INT and FLOAT elements share the comparison code
+#define INT_SIGN     0x0000800000000000ULL
+#define INT_EXPONENT 0x4330000000000000ULL
+
+#define FLOAT_LANES 8
+
+typedef struct {
+    const char *name;
+    uint64_t (*sum_int)(const uint64_t*, size_t);    // Of the elements with bit 47 flipped
+    double (*sum_float)(const double*, size_t);
+    uint64_t (*dot_int)(const uint64_t*, const uint64_t*, size_t);
+    double (*dot_float)(const double*, const double*, size_t);
+    size_t (*arg)(const uint64_t*, size_t, int ints, int max);
+    void (*elementwise)(KernelOp, uint64_t*, const uint64_t*, const uint64_t*, size_t);
+} KernelTable;
+
+static inline double arg_key(uint64_t raw, int ints) {
+    return AS_FLOAT(ints ? (raw ^ INT_SIGN) | INT_EXPONENT : raw);
+}
+
+static inline int is_better(double key, double best, int max) {
+    return max ? key > best : key < best;
+}
+
+// Lane k holds elements k, k + 8, ...: the remaining ones go to the lanes
+// in order, then the lanes are added pairwise
+static double lanes_finish(double *lane, const double *a, const double *b, size_t i, size_t count) {
+    for (int k = 0; i < count; i++, k++) lane[k] += b ? a[i] * b[i] : a[i];
+
+    double half[4];
+    for (int k = 0; k < 4; k++) half[k] = lane[k] + lane[k + 4];
+    return (half[0] + half[2]) + (half[1] + half[3]);
+}
+
+// Lanes found their first best element, the earliest of the best ones wins.
+// Elements from `i` on weren't seen by any lane.
+static size_t arg_finish(const double *value, const double *index, int lanes,
+                         const uint64_t *data, size_t i, size_t count, int ints, int max) {
+    int lane = 0;
+    for (int k = 1; k < lanes; k++) {
+        if (is_better(value[k], value[lane], max) || (value[k] == value[lane] && index[k] < index[lane]))
+            lane = k;
+    }
+
+    size_t best = (size_t) index[lane];
+    double best_key = value[lane];
+    for (; i < count; i++) {
+        double key = arg_key(data[i], ints);
+        if (is_better(key, best_key, max)) {
+            best = i;
+            best_key = key;
+        }
+    }
+    return best;
+}
+
+static uint64_t sum_int_scalar(const uint64_t *data, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) sum += data[i] ^ INT_SIGN;
+    return sum;
+}
+
+static double sum_float_scalar(const double *data, size_t count) {
+    double lane[FLOAT_LANES] = { 0 };
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES)
+        for (int k = 0; k < FLOAT_LANES; k++) lane[k] += data[i + k];
+    return lanes_finish(lane, data, NULL, i, count);
+}
+
+static uint64_t dot_int_scalar(const uint64_t *a, const uint64_t *b, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static double dot_float_scalar(const double *a, const double *b, size_t count) {
+    double lane[FLOAT_LANES] = { 0 };
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES)
+        for (int k = 0; k < FLOAT_LANES; k++) lane[k] += a[i + k] * b[i + k];
+    return lanes_finish(lane, a, b, i, count);
+}
+
+static size_t arg_scalar(const uint64_t *data, size_t count, int ints, int max) {
+    double value = arg_key(data[0], ints), index = 0;
+    return arg_finish(&value, &index, 1, data, 1, count, ints, max);
+}
+
+static void elementwise_scalar(KernelOp op, uint64_t *out, const uint64_t *a, const uint64_t *b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        switch (op) {
+            case KERNEL_ADD_INT:   out[i] = (a[i] + b[i]) & PAYLOAD_MASK; break;
+            case KERNEL_MUL_INT:   out[i] = (a[i] * b[i]) & PAYLOAD_MASK; break;
+            case KERNEL_ADD_FLOAT: out[i] = FROM_FLOAT(AS_FLOAT(a[i]) + AS_FLOAT(b[i])); break;
+            case KERNEL_MUL_FLOAT: out[i] = FROM_FLOAT(AS_FLOAT(a[i]) * AS_FLOAT(b[i])); break;
+        }
+    }
+}
+
+static const KernelTable scalar_kernels = {
+    "scalar", sum_int_scalar, sum_float_scalar, dot_int_scalar, dot_float_scalar,
+    arg_scalar, elementwise_scalar,
+};
+
+#ifdef KERNELS_X86
+
+// SSE2 is part of x86-64, these need no check
+
+static inline __m128i mullo_sse2(__m128i a, __m128i b) {
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+static inline __m128d select_sse2(__m128d mask, __m128d yes, __m128d no) {
+    return _mm_or_pd(_mm_and_pd(mask, yes), _mm_andnot_pd(mask, no));
+}
+
+static inline __m128i canonical_sse2(__m128d value) {
+    __m128d nan = _mm_cmpunord_pd(value, value);
+    return _mm_castpd_si128(select_sse2(nan, _mm_castsi128_pd(_mm_set1_epi64x(CANONICAL_NAN)), value));
+}
+
+static uint64_t sum_int_sse2(const uint64_t *data, size_t count) {
+    __m128i sum = _mm_setzero_si128(), sign = _mm_set1_epi64x(INT_SIGN);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+        sum = _mm_add_epi64(sum, _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + i)), sign));
+
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i*) lane, sum);
+    return lane[0] + lane[1] + sum_int_scalar(data + i, count - i);
+}
+
+static double sum_float_sse2(const double *data, size_t count) {
+    __m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES)
+        for (int k = 0; k < 4; k++) acc[k] = _mm_add_pd(acc[k], _mm_loadu_pd(data + i + 2 * k));
+
+    double lane[FLOAT_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lane + 2 * k, acc[k]);
+    return lanes_finish(lane, data, NULL, i, count);
+}
+
+static uint64_t dot_int_sse2(const uint64_t *a, const uint64_t *b, size_t count) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+        sum = _mm_add_epi64(sum, mullo_sse2(x, y));
+    }
+
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i*) lane, sum);
+    return lane[0] + lane[1] + dot_int_scalar(a + i, b + i, count - i);
+}
+
+static double dot_float_sse2(const double *a, const double *b, size_t count) {
+    __m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES)
+        for (int k = 0; k < 4; k++)
+            acc[k] = _mm_add_pd(acc[k], _mm_mul_pd(_mm_loadu_pd(a + i + 2 * k), _mm_loadu_pd(b + i + 2 * k)));
+
+    double lane[FLOAT_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lane + 2 * k, acc[k]);
+    return lanes_finish(lane, a, b, i, count);
+}
+
+static size_t arg_sse2(const uint64_t *data, size_t count, int ints, int max) {
+    __m128i sign = _mm_set1_epi64x(INT_SIGN), exponent = _mm_set1_epi64x(INT_EXPONENT);
+    __m128d best[2], best_index[2], index[2], step = _mm_set1_pd(4);
+    size_t i = 0;
+
+    for (int k = 0; k < 2; k++) {
+        best[k] = _mm_set1_pd(arg_key(data[0], ints));
+        best_index[k] = _mm_setzero_pd();
+        index[k] = _mm_set_pd(2 * k + 1, 2 * k);
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        for (int k = 0; k < 2; k++) {
+            __m128i raw = _mm_loadu_si128((const __m128i*) (data + i + 2 * k));
+            if (ints) raw = _mm_or_si128(_mm_xor_si128(raw, sign), exponent);
+            __m128d key = _mm_castsi128_pd(raw);
+
+            __m128d better = max ? _mm_cmpgt_pd(key, best[k]) : _mm_cmplt_pd(key, best[k]);
+            best[k] = select_sse2(better, key, best[k]);
+            best_index[k] = select_sse2(better, index[k], best_index[k]);
+            index[k] = _mm_add_pd(index[k], step);
+        }
+    }
+
+    double value[4], at[4];
+    for (int k = 0; k < 2; k++) {
+        _mm_storeu_pd(value + 2 * k, best[k]);
+        _mm_storeu_pd(at + 2 * k, best_index[k]);
+    }
+    return arg_finish(value, at, 4, data, i, count, ints, max);
+}
+
+static void elementwise_sse2(KernelOp op, uint64_t *out, const uint64_t *a, const uint64_t *b, size_t count) {
+    __m128i mask = _mm_set1_epi64x(PAYLOAD_MASK);
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+        __m128i result;
+        switch (op) {
+            case KERNEL_ADD_INT:   result = _mm_and_si128(_mm_add_epi64(x, y), mask); break;
+            case KERNEL_MUL_INT:   result = _mm_and_si128(mullo_sse2(x, y), mask); break;
+            case KERNEL_ADD_FLOAT: result = canonical_sse2(_mm_add_pd(_mm_castsi128_pd(x), _mm_castsi128_pd(y))); break;
+            default:               result = canonical_sse2(_mm_mul_pd(_mm_castsi128_pd(x), _mm_castsi128_pd(y))); break;
+        }
+        _mm_storeu_si128((__m128i*) (out + i), result);
+    }
+    elementwise_scalar(op, out + i, a + i, b + i, count - i);
+}
+
+static const KernelTable sse2_kernels = {
+    "sse2", sum_int_sse2, sum_float_sse2, dot_int_sse2, dot_float_sse2,
+    arg_sse2, elementwise_sse2,
+};
+
+// AVX2 versions, only called once __builtin_cpu_supports said so
+
+TARGET_AVX2 static inline __m256i mullo_avx2(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+TARGET_AVX2 static inline __m256i canonical_avx2(__m256d value) {
+    __m256d nan = _mm256_cmp_pd(value, value, _CMP_UNORD_Q);
+    return _mm256_castpd_si256(_mm256_blendv_pd(value, _mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN)), nan));
+}
+
+TARGET_AVX2 static uint64_t sum_int_avx2(const uint64_t *data, size_t count) {
+    __m256i sum = _mm256_setzero_si256(), sign = _mm256_set1_epi64x(INT_SIGN);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        sum = _mm256_add_epi64(sum, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (data + i)), sign));
+
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*) lane, sum);
+    return lane[0] + lane[1] + lane[2] + lane[3] + sum_int_scalar(data + i, count - i);
+}
+
+TARGET_AVX2 static double sum_float_avx2(const double *data, size_t count) {
+    __m256d low = _mm256_setzero_pd(), high = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES) {
+        low = _mm256_add_pd(low, _mm256_loadu_pd(data + i));
+        high = _mm256_add_pd(high, _mm256_loadu_pd(data + i + 4));
+    }
+
+    double lane[FLOAT_LANES];
+    _mm256_storeu_pd(lane, low);
+    _mm256_storeu_pd(lane + 4, high);
+    return lanes_finish(lane, data, NULL, i, count);
+}
+
+TARGET_AVX2 static uint64_t dot_int_avx2(const uint64_t *a, const uint64_t *b, size_t count) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+        sum = _mm256_add_epi64(sum, mullo_avx2(x, y));
+    }
+
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*) lane, sum);
+    return lane[0] + lane[1] + lane[2] + lane[3] + dot_int_scalar(a + i, b + i, count - i);
+}
+
+// Products and sums stay separate instructions: an FMA would round
+// differently from the other versions
+TARGET_AVX2 static double dot_float_avx2(const double *a, const double *b, size_t count) {
+    __m256d low = _mm256_setzero_pd(), high = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= count; i += FLOAT_LANES) {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    double lane[FLOAT_LANES];
+    _mm256_storeu_pd(lane, low);
+    _mm256_storeu_pd(lane + 4, high);
+    return lanes_finish(lane, a, b, i, count);
+}
+
+// Two sets of lanes, elements i..i+3 and i+4..i+7, so the compare and
+// blend chains overlap
+TARGET_AVX2 static size_t arg_avx2(const uint64_t *data, size_t count, int ints, int max) {
+    __m256i sign = _mm256_set1_epi64x(INT_SIGN), exponent = _mm256_set1_epi64x(INT_EXPONENT);
+    __m256d best[2], best_index[2], index[2], step = _mm256_set1_pd(8);
+    size_t i = 0;
+
+    for (int k = 0; k < 2; k++) {
+        best[k] = _mm256_set1_pd(arg_key(data[0], ints));
+        best_index[k] = _mm256_setzero_pd();
+        index[k] = _mm256_set_pd(4 * k + 3, 4 * k + 2, 4 * k + 1, 4 * k);
+    }
+
+    for (; i + 8 <= count; i += 8) {
+        for (int k = 0; k < 2; k++) {
+            __m256i raw = _mm256_loadu_si256((const __m256i*) (data + i + 4 * k));
+            if (ints) raw = _mm256_or_si256(_mm256_xor_si256(raw, sign), exponent);
+            __m256d key = _mm256_castsi256_pd(raw);
+
+            __m256d better = max ? _mm256_cmp_pd(key, best[k], _CMP_GT_OQ) : _mm256_cmp_pd(key, best[k], _CMP_LT_OQ);
+            best[k] = _mm256_blendv_pd(best[k], key, better);
+            best_index[k] = _mm256_blendv_pd(best_index[k], index[k], better);
+            index[k] = _mm256_add_pd(index[k], step);
+        }
+    }
+
+    double value[8], at[8];
+    for (int k = 0; k < 2; k++) {
+        _mm256_storeu_pd(value + 4 * k, best[k]);
+        _mm256_storeu_pd(at + 4 * k, best_index[k]);
+    }
+    return arg_finish(value, at, 8, data, i, count, ints, max);
+}
+
+TARGET_AVX2 static void elementwise_avx2(KernelOp op, uint64_t *out, const uint64_t *a, const uint64_t *b, size_t count) {
+    __m256i mask = _mm256_set1_epi64x(PAYLOAD_MASK);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+        __m256i result;
+        switch (op) {
+            case KERNEL_ADD_INT:   result = _mm256_and_si256(_mm256_add_epi64(x, y), mask); break;
+            case KERNEL_MUL_INT:   result = _mm256_and_si256(mullo_avx2(x, y), mask); break;
+            case KERNEL_ADD_FLOAT: result = canonical_avx2(_mm256_add_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y))); break;
+            default:               result = canonical_avx2(_mm256_mul_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y))); break;
+        }
+        _mm256_storeu_si256((__m256i*) (out + i), result);
+    }
+    elementwise_scalar(op, out + i, a + i, b + i, count - i);
+}
+
+static const KernelTable avx2_kernels = {
+    "avx2", sum_int_avx2, sum_float_avx2, dot_int_avx2, dot_float_avx2,
+    arg_avx2, elementwise_avx2,
+};
+
+#endif
+
+// Ordered by what they need from the CPU
+static const KernelTable *tables[] = {
+    &scalar_kernels,
+#ifdef KERNELS_X86
+    &sse2_kernels,
+    &avx2_kernels,
+#endif
+};
+
+static const KernelTable *active;
+
+int kernels_select(const char *name) {
+    size_t supported = 0;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("avx2") ? 2 : 1;
+#endif
+
+    if (!name) {
+        active = tables[supported];
+        return 1;
+    }
+
+    for (size_t i = 0; i <= supported; i++) {
+        if (strcmp(tables[i]->name, name) == 0) {
+            active = tables[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline const KernelTable *kernels(void) {
+    if (!active) kernels_select(NULL);
+    return active;
+}
+
+const char *kernels_name(void) {
+    return kernels()->name;
+}
+
+int64_t kernel_sum_int(const uint64_t *data, size_t count) {
+    return (int64_t) (kernels()->sum_int(data, count) - count * INT_SIGN);
+}
+
+double kernel_sum_float(const double *data, size_t count) {
+    return kernels()->sum_float(data, count);
+}
+
+uint64_t kernel_dot_int(const uint64_t *a, const uint64_t *b, size_t count) {
+    return kernels()->dot_int(a, b, count);
+}
+
+double kernel_dot_float(const double *a, const double *b, size_t count) {
+    return kernels()->dot_float(a, b, count);
+}
+
+size_t kernel_arg_int(const uint64_t *data, size_t count, int max) {
+    return kernels()->arg(data, count, 1, max);
+}
+
+size_t kernel_arg_float(const double *data, size_t count, int max) {
+    return kernels()->arg((const uint64_t*) data, count, 0, max);
+}
+
+void kernel_elementwise(KernelOp op, uint64_t *out, const uint64_t *a, const uint64_t *b, size_t count) {
+    kernels()->elementwise(op, out, a, b, count);
+}
@@ -0,0 +1,198 @@
+#include "../includes/loader.h"
+#include "../includes/opcodes.h"
+#include "../includes/opcode_handlers.h"
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The program file is mapped read-only. Constants become interned heap
+// blocks, and the code is decoded into the padded Instruction array in one
+// pass, which also rejects anything the dispatch loop doesn't check at run
+// time: unknown opcodes, jump targets outside the program, global slots,
+// local slots and constant indices out of range and truncated files. Local
+// slots are checked against the largest ENTER, which sizes the windows.
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int valid_opcode(uint8_t opcode) {
+    return (opcode >= OP_ADD && opcode <= OP_GE) || opcode_handlers[opcode] != NULL;
+}
+
+static int is_comparison(uint8_t opcode) {
+    return opcode >= OP_EQ_I && opcode <= OP_GE_F;
+}
+
+static void invalid(uint8_t opcode) {
+    instr_pc_log = &opcode;
+    handle_error(INVALID_BYTECODE);
+}
+
+// Checks the operand of one decoded instruction against the program and
+// global slot counts. Targets equal to `size` land on the OP_HALT sentinel.
+static void validate(const VM *vm, Instruction instr, uint32_t size, uint32_t globals) {
+    uint32_t target;
+
+    switch (instr.opcode) {
+        case OP_JUMP:
+        case OP_JUMP_IF:
+        case OP_CALL_DIRECT:
+        case OP_TAIL_CALL:
+            if (instr.arg > size) invalid(instr.opcode);
+            break;
+        case OP_CMP_JUMP_IF_FALSE:
+            target = instr.arg & 0xFFFFFF;
+            if (target > size || !is_comparison(instr.arg >> 24)) invalid(instr.opcode);
+            break;
+        case OP_CALL:
+            if (instr.arg == (uint32_t) -1) break;
+            // fallthrough - any other CALL reads a global slot like LOAD
+        case OP_LOAD:
+        case OP_STORE_MEM:
+        case OP_INC_MEM:
+            if (instr.arg >= globals) invalid(instr.opcode);
+            break;
+        case OP_LOAD_LOAD_ADD:
+            if ((instr.arg >> 16) >= globals || (instr.arg & 0xFFFF) >= globals) invalid(instr.opcode);
+            break;
+        case OP_LOAD_CONST:
+            if (instr.arg >= vm->constant_count) invalid(instr.opcode);
+            break;
+        case OP_GLOBALS:
+            break;
+    }
+}
+
+static void load_constants(VM *vm, const uint8_t *section, size_t bytes, uint32_t count) {
+    vm->constants = malloc(sizeof(Item) * (count ? count : 1));
+    if (!vm->constants) handle_error(UNDEFINED_ERROR);
+    vm->constant_count = count;
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (offset >= bytes) invalid(0);
+        uint8_t kind = section[offset++];
+
+        if (kind == CONST_FLOAT) {
+            double value;
+            if (bytes - offset < sizeof(double)) invalid(0);
+            memcpy(&value, section + offset, sizeof(double));
+            offset += sizeof(double);
+
+            vm->constants[i] = FROM_FLOAT(value);
+        } else if (kind == CONST_ARRAY) {
+            uint32_t length;
+            if (bytes - offset < 1 + sizeof(uint32_t)) invalid(0);
+            uint8_t type = section[offset];
+            memcpy(&length, section + offset + 1, sizeof(uint32_t));
+            offset += 1 + sizeof(uint32_t);
+
+            if (type < BOOL_TYPE || type > CHAR_TYPE || length > bytes - offset || length % sizes[type]) invalid(0);
+
+            size_t address = heap_add_block(&vm->heap, type);
+            heap_fill(&vm->heap, address, 0, section + offset, length);
+            vm->heap.blocks[address].flags |= BLOCK_CONST;
+            offset += length;
+
+            vm->constants[i] = BOX(ARRAY_TYPE, address);
+        } else {
+            invalid(0);
+        }
+    }
+
+    if (offset != bytes) invalid(0);
+}
+
+void load_image(VM *vm, const uint8_t *image, size_t bytes) {
+    const uint8_t *packed = image;
+    size_t code_bytes = bytes;
+    vm->constants = NULL;
+    vm->constant_count = 0;
+
+    if (bytes >= sizeof(BytecodeHeader) && memcmp(image, BYTECODE_MAGIC, 4) == 0) {
+        BytecodeHeader header;
+        memcpy(&header, image, sizeof(BytecodeHeader));
+
+        size_t available = bytes - sizeof(BytecodeHeader);
+        if (header.version != BYTECODE_VERSION || header.constant_bytes > available) invalid(0);
+
+        load_constants(vm, image + sizeof(BytecodeHeader), header.constant_bytes, header.constant_count);
+        packed = image + sizeof(BytecodeHeader) + header.constant_bytes;
+        code_bytes = available - header.constant_bytes;
+        if (code_bytes != (size_t) header.instructions * PACKED_INSTRUCTION_SIZE) invalid(0);
+    }
+
+    if (code_bytes % PACKED_INSTRUCTION_SIZE != 0 || code_bytes / PACKED_INSTRUCTION_SIZE >= INT32_MAX)
+        invalid(0);
+
+    uint32_t size = code_bytes / PACKED_INSTRUCTION_SIZE;
+    vm->program_size = size;
+    vm->bytecode = malloc(sizeof(Instruction) * (size + 1));
+    if (!vm->bytecode) handle_error(UNDEFINED_ERROR);
+
+    uint32_t globals = 0;
+    if (size > 0 && packed[0] == OP_GLOBALS) memcpy(&globals, packed + 1, sizeof(uint32_t));
+
+    uint32_t window = 0, local_slots = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        const uint8_t *record = packed + (size_t) i * PACKED_INSTRUCTION_SIZE;
+        Instruction instr = { record[0], 0 };
+        memcpy(&instr.arg, record + 1, sizeof(uint32_t));
+
+        if (!valid_opcode(instr.opcode)) invalid(instr.opcode);
+        validate(vm, instr, size, globals);
+        vm->bytecode[i] = instr;
+
+        if (instr.opcode == OP_ENTER && instr.arg > window) window = instr.arg;
+        if ((instr.opcode == OP_LOAD_LOCAL || instr.opcode == OP_STORE_LOCAL) && instr.arg >= local_slots)
+            local_slots = instr.arg + 1;
+    }
+    vm->bytecode[size] = (Instruction) { OP_HALT, 0 };
+    if (local_slots > window || window > LOCALS_LIMIT) invalid(OP_ENTER);
+
+    globals_init(&vm->globals, globals);
+    locals_init(&vm->locals, window);
+}
+
+void load_program(VM *vm, const char *filename, LoadStats *stats) {
+    double start = now_ms();
+
+    // stdio rather than open/close: unistd.h declares its own syscall()
+    FILE *file = fopen(filename, "rb");
+    if (!file) handle_error(FILE_NOT_FOUND);
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) handle_error(FILE_NOT_FOUND);
+
+    size_t bytes = st.st_size;
+    const uint8_t *mapping = NULL;
+    if (bytes > 0) {
+        mapping = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (mapping == MAP_FAILED) handle_error(FILE_PERMISSION_ERROR);
+        madvise((void*) mapping, bytes, MADV_SEQUENTIAL);
+    }
+    fclose(file);
+
+    double mapped = now_ms();
+    load_image(vm, mapping, bytes);
+    if (mapping) munmap((void*) mapping, bytes);
+
+    stats->constants = vm->constant_count;
+    stats->instructions = vm->program_size;
+    stats->bytes = bytes;
+    stats->map_ms = mapped - start;
+    stats->decode_ms = now_ms() - mapped;
+}
+
+void print_load_stats(const LoadStats *stats, FILE *out) {
+    double total = stats->map_ms + stats->decode_ms;
+
+    fprintf(out, "Load: %zu instructions, %zu constants, %zu bytes in %.3f ms (map %.3f ms, validate + decode %.3f ms, %.1f M instructions/s)\n",
+        stats->instructions, stats->constants, stats->bytes, total, stats->map_ms, stats->decode_ms,
+        total > 0 ? stats->instructions / total / 1e3 : 0.0);
+}
@@ -2,157 +2,425 @@
 
 size_t sizes[ARRAY_TYPE + 1] = {
     [BOOL_TYPE]  = 1,
-    [INT_TYPE]   = 4,
-    [FLOAT_TYPE] = 4,
+    [INT_TYPE]   = 8,
+    [FLOAT_TYPE] = 8,
     [CHAR_TYPE]  = 1,
     [ARRAY_TYPE] = 4
 };
 
+// Empty blocks own no payload until the first write
 void memory_init(Memory *mem) {
-    mem->data = malloc(sizeof(uint8_t));
-    mem->table_type = malloc(sizeof(DataType));
+    mem->data = NULL;
     mem->size = 0;
+    mem->capacity = 0;
 }
 
-void memory_destroy(Memory *mem) {
-    if (mem->data) {
-        free(mem->data);
-        mem->data = NULL;
-    }
+// A view doesn't own its payload, the source block frees it
+void memory_destroy(Slab *slab, Memory *mem) {
+    if (!(mem->flags & BLOCK_VIEW)) slab_free(slab, mem->data, mem->capacity);
+    mem->data = NULL;
+    mem->size = 0;
+    mem->capacity = 0;
+}
 
-    if (mem->table_type) {
-        free(mem->table_type);
-        mem->table_type = NULL;
-    }
+// Grows the allocation to at least `capacity` bytes, the length is untouched
+int memory_reserve(Slab *slab, Memory *mem, size_t capacity) {
+    if (capacity <= mem->capacity) return 0;
+    if (capacity > UINT32_MAX) return -1;
 
-    mem->size = 0;
+    size_t new_capacity;
+    mem->data = slab_resize(slab, mem->data, mem->size, mem->capacity, capacity, &new_capacity);
+    mem->capacity = new_capacity;
+
+    return 0;
 }
 
-int memory_expand(Memory *mem, size_t new_size) {
+// Extends the length to `new_size`, doubling the capacity when it runs out
+// so a sequence of appends costs amortized O(1) each
+int memory_expand(Slab *slab, Memory *mem, size_t new_size) {
     if (new_size <= mem->size) return 0;
 
-    uint8_t *new_data = realloc(mem->data, new_size);
-    DataType *new_table_type = realloc(mem->table_type, new_size);
-    if (!new_data) return -1;
+    if (new_size > mem->capacity) {
+        size_t capacity = (size_t) mem->capacity * 2;
+        if (capacity < new_size) capacity = new_size;
+        if (memory_reserve(slab, mem, capacity) != 0) return -1;
+    }
 
-    mem->data = new_data;
-    mem->table_type = new_table_type;
     mem->size = new_size;
-
     return 0;
 }
 
-int memory_write(Memory *mem, uint32_t address, uint32_t value, size_t size) {
-    if (size == 0 || size > 4) 
+int memory_write(Slab *slab, Memory *mem, uint32_t address, uint64_t value, size_t size) {
+    if (size == 0 || size > 8) 
         handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
 
     if (address == (uint32_t) -1 || mem == NULL) {
         address = mem->size;
-        if (memory_expand(mem, address + size) != 0)
+        if (memory_expand(slab, mem, address + size) != 0)
             handle_error(UNDEFINED_ERROR);
     }
 
     if (address + size > mem->size)
         handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(mem->data + address, &value, size);
+#else
     for (size_t i = 0; i < size; ++i)
         mem->data[address + i] = (uint8_t)(value >> (8 * i));
+#endif
 
     return address;
 }
 
-int memory_read(Memory *mem, uint32_t address, uint32_t *value, size_t size) {
-    if (size == 0 || size > 4 || address + size > mem->size) 
+int memory_read(Memory *mem, uint32_t address, uint64_t *value, size_t size) {
+    if (size == 0 || size > 8 || address + size > mem->size) 
         handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
 
     *value = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(value, mem->data + address, size);
+#else
     for (size_t i = 0; i < size; ++i)
-        *value |= ((uint32_t)mem->data[address + i]) << (8 * i);
+        *value |= ((uint64_t)mem->data[address + i]) << (8 * i);
+#endif
 
     return 0;
 }
 
+void globals_init(Globals *globals, size_t size) {
+    globals->slots = malloc(sizeof(Item) * (size ? size : 1));
+    if (!globals->slots) handle_error(UNDEFINED_ERROR);
+    globals->size = size;
+
+    for (size_t i = 0; i < size; i++)
+        globals->slots[i] = BOX(UNASSIGNED_TYPE, 0);
+}
+
+void globals_destroy(Globals *globals) {
+    free(globals->slots);
+    globals->slots = NULL;
+    globals->size = 0;
+}
+
+void locals_init(Locals *locals, uint32_t window) {
+    locals->slots = NULL;
+    locals->capacity = 0;
+    locals->window = window;
+    locals_grow(locals, 0);
+    locals->frame = locals->slots;
+    locals->top = 0;
+}
+
+// Makes room for a window starting at base. New slots hold UNASSIGNED items,
+// so the collector never reads uninitialized memory.
+void locals_grow(Locals *locals, uint32_t base) {
+    size_t needed = (size_t) base + locals->window;
+    size_t capacity = locals->capacity ? locals->capacity : INITIAL_LOCALS;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > UINT32_MAX) handle_error(MAX_RECURSION_DEPTH_EXCEEDED);
+    if (capacity == locals->capacity) return;
+
+    uint32_t frame = locals->slots ? locals_base(locals) : 0;
+    Item *slots = realloc(locals->slots, sizeof(Item) * capacity);
+    if (!slots) handle_error(MAX_RECURSION_DEPTH_EXCEEDED);
+
+    for (size_t i = locals->capacity; i < capacity; i++)
+        slots[i] = BOX(UNASSIGNED_TYPE, 0);
+
+    locals->slots = slots;
+    locals->frame = slots + frame;
+    locals->capacity = capacity;
+}
+
+void locals_destroy(Locals *locals) {
+    free(locals->slots);
+    locals->slots = NULL;
+    locals->frame = NULL;
+    locals->top = 0;
+    locals->capacity = 0;
+}
+
 void heap_init(Heap *heap) {
     heap->blocks = NULL;
-    heap->table_type = NULL;
+    heap->free_list = NULL;
+    heap->free_count = 0;
     heap->size = 0;
+    heap->capacity = 0;
+    heap->gc = (GCState) { 0 };
+    heap->slab = (Slab) { 0 };
 }
 
 void heap_destroy(Heap *heap) {
     for (size_t i = 0; i < heap->size; ++i)
-        memory_destroy(&heap->blocks[i]);
+        memory_destroy(&heap->slab, &heap->blocks[i]);
 
     free(heap->blocks);
-    free(heap->table_type);
+    free(heap->free_list);
+    slab_release(&heap->slab);
     heap->blocks = NULL;
-    heap->table_type = NULL;
+    heap->free_list = NULL;
+    heap->free_count = 0;
     heap->size = 0;
+    heap->capacity = 0;
 }
 
-size_t heap_add_block(Heap *heap, DataType type) {
-    Memory *new_blocks = realloc(heap->blocks, sizeof(Memory) * (heap->size + 1));
-    DataType *new_types = realloc(heap->table_type, sizeof(DataType) * (heap->size + 1));
-    if (new_types == NULL || new_blocks == NULL) return -1;
+static int heap_grow(Heap *heap) {
+    size_t capacity = heap->capacity ? heap->capacity * 2 : INITIAL_HEAP_BLOCKS;
 
+    Memory *new_blocks = realloc(heap->blocks, sizeof(Memory) * capacity);
+    if (new_blocks == NULL) return -1;
     heap->blocks = new_blocks;
-    heap->table_type = new_types;
 
-    memory_init(&heap->blocks[heap->size]);
-    heap->table_type[heap->size] = type;
+    size_t *new_free_list = realloc(heap->free_list, sizeof(size_t) * capacity);
+    if (new_free_list == NULL) return -1;
+    heap->free_list = new_free_list;
+
+    heap->capacity = capacity;
+    return 0;
+}
+
+// Reuses a swept block index when there is one. Never collects by itself,
+// it only flags the collection for the next safe point in the VM loop.
+size_t heap_add_block(Heap *heap, DataType type) {
+    size_t index;
+
+    if (heap->free_count > 0) {
+        index = heap->free_list[--heap->free_count];
+    } else {
+        if (heap->size == heap->capacity && heap_grow(heap) != 0) return -1;
+        index = heap->size++;
+    }
+
+    memory_init(&heap->blocks[index]);
+    heap->blocks[index].type = type;
+    heap->blocks[index].flags = 0;
+    heap->blocks[index].sharers = 0;
+
+    if (++heap->gc.allocations >= heap->gc.threshold && heap->gc.threshold)
+        heap->gc.pending = 1;
 
-    heap->size++;
-    return heap->size - 1;
+    return index;
+}
+
+// Converts one unboxed element between scalar types
+uint64_t convert_raw(uint64_t raw, DataType from_type, DataType to_type) {
+    Item item = item_from_raw(from_type, raw);
+    double number = IS_FLOAT(item) ? AS_FLOAT(item) : (double) AS_INT(item);
+
+    if (to_type == FLOAT_TYPE) return item_to_raw(FROM_FLOAT(number));
+    if (to_type == INT_TYPE) return item_to_raw(FROM_INT((int64_t) number));
+    return item_to_raw(BOX(to_type, IS_FLOAT(item) ? (int64_t) number : AS_INT(item)));
 }
 
 size_t duplicate_heap_block(Heap *heap, size_t address, DataType to_type, int depth) {
     if (address >= heap->size) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
     
-    Memory src = heap->blocks[address];
-    
-    DataType type = (depth == 1) ? to_type : heap->table_type[address];
+    DataType from_type = heap->blocks[address].type;
+
+    // Same stored bytes (one type, or CHAR and BOOL, which only differ in
+    // their tag): the payload is shared until one side writes to it
+    int same_bytes = from_type == to_type || (sizes[from_type] == 1 && sizes[to_type] == 1);
+    if (depth == 1 && same_bytes)
+        return heap_share(heap, address, to_type);
+
+    DataType type = (depth == 1) ? to_type : from_type;
     size_t new_index = heap_add_block(heap, type);
-    if (new_index == -1) return -1;
-    
-    Memory *dst = &heap->blocks[new_index];
-    if (memory_expand(dst, src.size) != 0) return -1;
-    
-    for (size_t i = 0; i < src.size; i++) {
-        if (depth == 1) {
-            uint32_t value;
-            heap_read(heap, address, &value, i * sizes[to_type], sizes[to_type]);
-            heap_write(heap, new_index, value, i * sizes[to_type], sizes[to_type]);
-        } else {
-            uint32_t child_address = src.data[i];
-            size_t new_child = duplicate_heap_block(heap, child_address, to_type, depth - 1);
-            if (new_child == -1) return -1;
-
-            heap_write(heap, new_index, new_child, i, 1);
+    if (new_index == (size_t) -1) return -1;
+
+    size_t src_size = heap->blocks[address].size;
+
+    if (depth == 1) {
+        size_t from_size = sizes[from_type], to_size = sizes[to_type];
+        size_t count = from_size ? src_size / from_size : 0;
+        heap_reserve(heap, new_index, count * to_size);
+
+        for (size_t i = 0; i < count; i++) {
+            uint64_t value;
+            heap_read(heap, address, &value, i * from_size, from_size);
+            heap_write(heap, new_index, convert_raw(value, from_type, to_type), i * to_size, to_size);
         }
+
+        return new_index;
+    }
+
+    size_t child_size = sizes[ARRAY_TYPE];
+    heap_reserve(heap, new_index, src_size);
+
+    for (size_t offset = 0; offset + child_size <= src_size; offset += child_size) {
+        uint64_t child_address;
+        heap_read(heap, address, &child_address, offset, child_size);
+        size_t new_child = duplicate_heap_block(heap, child_address, to_type, depth - 1);
+        if (new_child == (size_t) -1) return -1;
+
+        heap_write(heap, new_index, new_child, offset, child_size);
     }
 
     return new_index;
 }
 
-int heap_write(Heap *heap, size_t index, uint32_t value, size_t offset, size_t size) {
+// A block counts the views and rope nodes over it, so writing to it only
+// looks for them when there are some. An owner, which is never a view
+// itself, remembers the last one in `source`: when that was the only one,
+// the usual case, the heap isn't scanned. The count stays put once it
+// saturates, until the next scan.
+static void add_sharer(Heap *heap, size_t index, size_t sharer) {
+    Memory *block = &heap->blocks[index];
+    if (block->sharers < UINT16_MAX) block->sharers++;
+    if (!(block->flags & BLOCK_VIEW)) block->source = sharer;
+}
+
+static void remove_sharer(Heap *heap, size_t index) {
+    Memory *block = &heap->blocks[index];
+    if (block->sharers > 0 && block->sharers < UINT16_MAX) block->sharers--;
+}
+
+void heap_unlink(Heap *heap, size_t index) {
+    Memory *block = &heap->blocks[index];
+    if (block->flags & BLOCK_VIEW) {
+        remove_sharer(heap, block->source);
+    } else if (block->flags & BLOCK_ROPE) {
+        RopeNode *node = (RopeNode*) block->data;
+        remove_sharer(heap, node->left);
+        remove_sharer(heap, node->right);
+    }
+}
+
+// Gives a view a private copy of the payload it borrows
+static void detach_view(Heap *heap, size_t index) {
+    Memory *block = &heap->blocks[index];
+    remove_sharer(heap, block->source);
+
+    size_t capacity;
+    uint8_t *data = slab_alloc(&heap->slab, block->size, &capacity);
+    if (block->size) memcpy(data, block->data, block->size);
+
+    block->data = data;
+    block->capacity = capacity;
+    block->flags &= ~BLOCK_VIEW;
+}
+
+// Separates `sharer` from the payload of `index` if it is a rope or a view
+// over it. Returns 0 when it isn't.
+static int release_sharer(Heap *heap, size_t index, size_t sharer) {
+    if (sharer >= heap->size) return 0;
+    Memory *block = &heap->blocks[sharer];
+    if (block->flags & BLOCK_FREE) return 0;
+
+    if (block->flags & BLOCK_ROPE) {
+        RopeNode *node = (RopeNode*) block->data;
+        if (node->left != index && node->right != index) return 0;
+        heap_flatten(heap, sharer);
+        return 1;
+    }
+    if (block->flags & BLOCK_VIEW && block->source == index) {
+        detach_view(heap, sharer);
+        return 1;
+    }
+    return 0;
+}
+
+// Ropes are flattened before their payload is read. A block referenced by
+// a rope or a view is about to change under it, so those take their own copy
+// first, and a view copies the payload it borrows before its first write.
+static void make_writable(Heap *heap, size_t index) {
+    Memory *block = &heap->blocks[index];
+    if (block->flags & BLOCK_CONST) handle_error(UNDEFINED_ERROR);
+    heap_flatten(heap, index);
+
+    if (block->sharers && !(block->flags & BLOCK_VIEW)) release_sharer(heap, index, block->source);
+    if (block->sharers) {
+        for (size_t i = 0; i < heap->size; i++) release_sharer(heap, index, i);
+        block->sharers = 0;
+    }
+
+    if (block->flags & BLOCK_VIEW) detach_view(heap, index);
+}
+
+int heap_write(Heap *heap, size_t index, uint64_t value, size_t offset, size_t size) {
     if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    make_writable(heap, index);
 
     if (offset + size > heap->blocks[index].size) 
-        memory_expand(&heap->blocks[index], offset + size);
+        memory_expand(&heap->slab, &heap->blocks[index], offset + size);
     
-    return memory_write(&heap->blocks[index], offset, value, size);
+    return memory_write(&heap->slab, &heap->blocks[index], offset, value, size);
 }
 
-int heap_read(Heap *heap, size_t index, uint32_t *value, size_t offset, size_t size) {
+// Preallocates room for `bytes` bytes so the writes that follow never realloc
+int heap_reserve(Heap *heap, size_t index, size_t bytes) {
     if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    make_writable(heap, index);
+    return memory_reserve(&heap->slab, &heap->blocks[index], bytes);
+}
+
+int heap_read(Heap *heap, size_t index, uint64_t *value, size_t offset, size_t size) {
+    if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    heap_flatten(heap, index);
     return memory_read(&heap->blocks[index], offset, value, size);
 }
 
+// Range primitives: move runs of bytes with one memcpy instead of one
+// heap_read/heap_write per element. Offsets and lengths are in bytes.
+
+// Copies `bytes` bytes of `src` into `dst`, growing `dst` if needed.
+// dst and src may be the same block.
+int heap_copy(Heap *heap, size_t dst, size_t dst_offset, size_t src, size_t src_offset, size_t bytes) {
+    if (dst >= heap->size || src >= heap->size) handle_error(UNDEFINED_ERROR);
+    if (src_offset + bytes > heap->blocks[src].size) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
+    if (bytes == 0) return 0;
+
+    make_writable(heap, dst);
+    heap_flatten(heap, src);
+
+    if (memory_expand(&heap->slab, &heap->blocks[dst], dst_offset + bytes) != 0) return -1;
+    memmove(heap->blocks[dst].data + dst_offset, heap->blocks[src].data + src_offset, bytes);
+    return 0;
+}
+
+// Writes `bytes` bytes from a C buffer into a block, growing it if needed
+int heap_fill(Heap *heap, size_t index, size_t offset, const void *buffer, size_t bytes) {
+    if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    if (bytes == 0) return 0;
+
+    make_writable(heap, index);
+    if (memory_expand(&heap->slab, &heap->blocks[index], offset + bytes) != 0) return -1;
+    memcpy(heap->blocks[index].data + offset, buffer, bytes);
+    return 0;
+}
+
+// Sets the length of a block, new bytes are left uninitialized
+int heap_resize(Heap *heap, size_t index, size_t bytes) {
+    if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    make_writable(heap, index);
+
+    Memory *block = &heap->blocks[index];
+    if (bytes <= block->size) {
+        block->size = bytes;
+        return 0;
+    }
+
+    return memory_expand(&heap->slab, block, bytes);
+}
+
+// Read-only contiguous view of a block's payload, flattening a rope. Valid
+// until the block is resized or freed, adding other blocks does not move it.
+// Writers call heap_resize first so ropes sharing the block are detached.
+uint8_t *heap_span(Heap *heap, size_t index, size_t *bytes) {
+    if (index >= heap->size) handle_error(UNDEFINED_ERROR);
+    heap_flatten(heap, index);
+
+    *bytes = heap->blocks[index].size;
+    return heap->blocks[index].data;
+}
+
 int heap_remove_element(Heap *heap, size_t block_index, size_t element_index, size_t element_size) {
     if (block_index >= heap->size) {
         handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
         return -1;
     }
 
+    make_writable(heap, block_index);
     Memory *block = &heap->blocks[block_index];
     size_t total_elements = block->size / element_size;
 
@@ -170,7 +438,167 @@ int heap_remove_element(Heap *heap, size_t block_index, size_t element_index, si
                 move_size);
     }
 
-    block->size -= 1;
+    block->size -= element_size;
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Copies the first `head_size` bytes of `head` and the first `tail_size` bytes
+// of `tail` into a new flat block
+static size_t flat_copy(Heap *heap, size_t head, size_t head_size, size_t tail, size_t tail_size,
+                        DataType type, uint8_t flags) {
+    size_t index = heap_add_block(heap, type);
+    if (index == (size_t) -1) handle_error(UNDEFINED_ERROR);
+
+    heap_reserve(heap, index, head_size + tail_size);
+    heap_copy(heap, index, 0, head, 0, head_size);
+    heap_copy(heap, index, head_size, tail, 0, tail_size);
+    heap->blocks[index].flags |= flags;
+    return index;
+}
+
+// Copy in O(1): a new header of element type `type` over the same payload.
+// Whichever side is written first copies it (make_writable), so a copy that
+// is only ever read costs one header. Views always borrow from the owner.
+size_t heap_share(Heap *heap, size_t index, DataType type) {
+    if (index >= heap->size) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
+    heap_flatten(heap, index);
+
+    size_t size = heap->blocks[index].size;
+    if (heap->blocks[index].flags & BLOCK_VIEW) index = heap->blocks[index].source;
+
+    size_t view = heap_add_block(heap, type);
+    if (view == (size_t) -1) handle_error(UNDEFINED_ERROR);
+    if (size == 0) return view;
+
+    Memory *block = &heap->blocks[view], *owner = &heap->blocks[index];
+    block->data = owner->data;
+    block->size = size;
+    block->source = index;
+    block->flags |= BLOCK_VIEW;
+    add_sharer(heap, index, view);
+    return view;
+}
+
+static size_t private_leaf(Heap *heap, size_t index, DataType type) {
+    return flat_copy(heap, index, heap->blocks[index].size, index, 0, type, BLOCK_LEAF);
+}
+
+static size_t rope_node(Heap *heap, size_t left, size_t left_size, size_t right, size_t length, DataType type) {
+    if (length > UINT32_MAX) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
+
+    size_t index = heap_add_block(heap, type);
+    if (index == (size_t) -1) handle_error(UNDEFINED_ERROR);
+
+    Memory *block = &heap->blocks[index];
+    size_t capacity;
+    RopeNode *node = slab_alloc(&heap->slab, sizeof(RopeNode), &capacity);
+    node->left = left;
+    node->right = right;
+    node->left_size = left_size;
+
+    block->data = (uint8_t*) node;
+    block->capacity = capacity;
+    block->size = length;
+    block->flags |= BLOCK_ROPE;
+
+    add_sharer(heap, left, index);
+    add_sharer(heap, right, index);
+    return index;
+}
+
+// Concatenation in O(1) for long strings: the result is a new rope node over
+// both operands, neither of which is modified. Short operands are copied into
+// private leaves, and appending to a rope whose last leaf nobody has grown yet
+// extends that leaf in place.
+size_t heap_concat(Heap *heap, size_t left, size_t right, DataType type) {
+    if (left >= heap->size || right >= heap->size) handle_error(UNDEFINED_ERROR);
+
+    size_t left_size = heap->blocks[left].size, right_size = heap->blocks[right].size;
+    size_t length = left_size + right_size;
+    if (length <= ROPE_LEAF_SIZE) return flat_copy(heap, left, left_size, right, right_size, type, 0);
+
+    if (right_size <= ROPE_LEAF_SIZE && heap->blocks[left].flags & BLOCK_ROPE) {
+        RopeNode node = *(RopeNode*) heap->blocks[left].data;
+        size_t tail_size = left_size - node.left_size;
+        Memory *tail = &heap->blocks[node.right];
+
+        if (tail->flags & BLOCK_LEAF && tail_size + right_size <= ROPE_LEAF_SIZE) {
+            if (tail->size == tail_size) {
+                // Older nodes only see the first tail_size bytes, so the leaf
+                // grows in place. It is private, there is nothing to detach.
+                heap_flatten(heap, right);
+                if (memory_expand(&heap->slab, tail, tail_size + right_size) != 0) handle_error(UNDEFINED_ERROR);
+                if (right_size) memcpy(tail->data + tail_size, heap->blocks[right].data, right_size);
+                return rope_node(heap, node.left, node.left_size, node.right, length, type);
+            }
+
+            size_t leaf = flat_copy(heap, node.right, tail_size, right, right_size, type, BLOCK_LEAF);
+            return rope_node(heap, node.left, node.left_size, leaf, length, type);
+        }
+    }
+
+    if (left_size <= ROPE_LEAF_SIZE && heap->blocks[right].flags & BLOCK_ROPE) {
+        RopeNode node = *(RopeNode*) heap->blocks[right].data;
+        if (node.left_size + left_size <= ROPE_LEAF_SIZE) {
+            size_t leaf = flat_copy(heap, left, left_size, node.left, node.left_size, type, BLOCK_LEAF);
+            return rope_node(heap, leaf, left_size + node.left_size, node.right, length, type);
+        }
+    }
+
+    if (left_size <= ROPE_LEAF_SIZE) left = private_leaf(heap, left, type);
+    if (right_size <= ROPE_LEAF_SIZE) right = private_leaf(heap, right, type);
+    return rope_node(heap, left, left_size, right, length, type);
+}
+
+// Replaces a rope's payload with the bytes of its leaves. Pieces are copied
+// left to right, right halves wait on an explicit stack since appending in a
+// loop builds ropes as deep as the number of leaves.
+typedef struct {
+    uint32_t index;
+    uint32_t bytes;
+} RopePiece;
+
+void heap_flatten(Heap *heap, size_t index) {
+    Memory *block = &heap->blocks[index];
+    if (!(block->flags & BLOCK_ROPE)) return;
+
+    size_t length = block->size, capacity, written = 0;
+    uint8_t *data = slab_alloc(&heap->slab, length, &capacity);
+
+    size_t count = 0, limit = 64;
+    RopePiece *pending = malloc(sizeof(RopePiece) * limit);
+    if (!pending) handle_error(UNDEFINED_ERROR);
+    pending[count++] = (RopePiece) { index, length };
+
+    while (count > 0) {
+        RopePiece piece = pending[--count];
+        Memory *part = &heap->blocks[piece.index];
+
+        if (part->flags & BLOCK_ROPE) {
+            if (count + 2 > limit) {
+                limit *= 2;
+                RopePiece *new_pending = realloc(pending, sizeof(RopePiece) * limit);
+                if (!new_pending) handle_error(UNDEFINED_ERROR);
+                pending = new_pending;
+            }
+
+            RopeNode *node = (RopeNode*) part->data;
+            pending[count++] = (RopePiece) { node->right, part->size - node->left_size };
+            pending[count++] = (RopePiece) { node->left, node->left_size };
+            continue;
+        }
+
+        size_t bytes = (piece.bytes < part->size) ? piece.bytes : part->size;
+        if (bytes) memcpy(data + written, part->data, bytes);
+        written += bytes;
+    }
+
+    free(pending);
+    heap_unlink(heap, index);
+    slab_free(&heap->slab, block->data, block->capacity);
+    block->data = data;
+    block->size = written;
+    block->capacity = capacity;
+    block->flags &= ~BLOCK_ROPE;
+}
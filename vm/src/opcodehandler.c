@@ -1,115 +1,147 @@
 #include "../includes/opcode_handlers.h"
 
+void grow_frames(VM *vm) {
+    if (vm->frame_pointer >= vm->max_depth) handle_error(MAX_RECURSION_DEPTH_EXCEEDED);
+
+    int new_capacity = vm->frame_capacity * 2;
+    if (new_capacity > vm->max_depth) new_capacity = vm->max_depth;
+
+    Frame *new_frames = realloc(vm->frames, sizeof(Frame) * new_capacity);
+    if (!new_frames) handle_error(MAX_RECURSION_DEPTH_EXCEEDED);
+
+    vm->frames = new_frames;
+    vm->frame_capacity = new_capacity;
+}
+
+// Pushes a call frame and jumps to the function, the dispatch loop keeps running
 void run_function(VM* vm, uint32_t func_id) {
-    if (vm->frame_pointer > RECURSION_LIMIT) handle_error(MAX_RECURSION_DEPTH_EXCEEDED);
-    vm->return_address[vm->frame_pointer++] = vm->pc;
+    if (func_id > (uint32_t) vm->program_size) handle_error(INVALID_BYTECODE);
+    frame_push(vm, vm->pc);
     vm->pc = vm->bytecode + func_id;
-    vm_run(vm);
 }
 
 void handle_store(VM *vm, Instruction instr) {
-    Item data = { INT_TYPE, instr.arg };
-    push(&vm->stack, data);
+    push(&vm->stack, FROM_INT((int32_t) instr.arg));
 }
 
 void handle_store_byte(VM *vm, Instruction instr) {
-    Item arg = { BOOL_TYPE, instr.arg };
-    push(&vm->stack, arg);
+    push(&vm->stack, BOX(BOOL_TYPE, instr.arg));
 }
 
 void handle_store_float(VM *vm, Instruction instr) {
-    Item arg = { FLOAT_TYPE, instr.arg };
-    push(&vm->stack, arg);
+    push(&vm->stack, FROM_FLOAT(float_from_bits(instr.arg)));
 }
 
 void handle_store_char(VM *vm, Instruction instr) {
-    Item arg = { CHAR_TYPE, instr.arg };
-    push(&vm->stack, arg);
+    push(&vm->stack, BOX(CHAR_TYPE, instr.arg));
 }
 
 void handle_store_mem(VM *vm, Instruction instr) {
-    Item aux = pop(&vm->stack);
-    int address = memory_write(&vm->memory, instr.arg, aux.value, sizes[aux.type]);
-    if (address == -1) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
-    vm->memory.table_type[address] = aux.type;
+    vm->globals.slots[instr.arg] = heap_own(&vm->heap, pop(&vm->stack));
+}
+
+void handle_load_const(VM *vm, Instruction instr) {
+    push(&vm->stack, vm->constants[instr.arg]);
 }
 
 void handle_load(VM *vm, Instruction instr) {
-    uint32_t buffer;
-    DataType buffer_type = vm->memory.table_type[instr.arg];
-    size_t size_buffer = sizes[buffer_type];
+    push(&vm->stack, vm->globals.slots[instr.arg]);
+}
 
-    memory_read(&vm->memory, instr.arg, &buffer, size_buffer);
-    push(&vm->stack, (Item){ buffer_type, buffer });
+void handle_load_local(VM *vm, Instruction instr) {
+    push(&vm->stack, vm->locals.frame[instr.arg]);
 }
 
+void handle_store_local(VM *vm, Instruction instr) {
+    vm->locals.frame[instr.arg] = heap_own(&vm->heap, pop(&vm->stack));
+}
+
+void handle_enter(VM *vm, Instruction instr) {
+    locals_enter(&vm->locals, instr.arg);
+}
+
+// Slots are allocated by vm_init from this instruction
+void handle_globals(VM *vm, Instruction instr) {}
+
 void handle_jump(VM *vm, Instruction instr) {
     vm->pc = vm->bytecode + instr.arg;
 }
 
 void handle_jump_if(VM *vm, Instruction instr) {
-    uint32_t aux = pop(&vm->stack).value;
-    if (aux != (uint32_t) 0)
+    if (AS_BOOL(pop(&vm->stack)))
         vm->pc = vm->bytecode + instr.arg;
 }
 
 void handle_call(VM *vm, Instruction instr) {
-    uint32_t dir = (instr.arg == -1) ? pop(&vm->stack).value : vm->memory.data[instr.arg];
-    run_function(vm, dir);
+    Item dir = (instr.arg == (uint32_t) -1) ? pop(&vm->stack) : vm->globals.slots[instr.arg];
+    run_function(vm, ITEM_BITS(dir));
+}
+
+void handle_call_direct(VM *vm, Instruction instr) {
+    run_function(vm, instr.arg);
+}
+
+// The callee returns straight to our caller, its ENTER reuses our window
+void handle_tail_call(VM *vm, Instruction instr) {
+    vm->locals.top = locals_base(&vm->locals);
+    vm->pc = vm->bytecode + instr.arg;
 }
 
 void handle_return(VM *vm, Instruction instr) {
-    vm->pc = vm->return_address[--vm->frame_pointer];
+    if (vm->frame_pointer == 0) {
+        vm->pc = vm->bytecode + vm->program_size;
+        return;
+    }
+
+    vm->pc = frame_pop(vm);
 }
 
 void handle_build_list(VM *vm, Instruction instr) {
     if (instr.arg == 0) {
-        push(&vm->stack, 
-            (Item) { 
-                ARRAY_TYPE,
-                heap_add_block(&vm->heap, UNASSIGNED_TYPE) 
-            });
+        push(&vm->stack, BOX(ARRAY_TYPE, heap_add_block(&vm->heap, UNASSIGNED_TYPE)));
         return;
     }
     
-    Item item = pop(&vm->stack);
-    size_t address = heap_add_block(&vm->heap, item.type);
-    size_t len = sizes[item.type];
-    heap_write(&vm->heap, address, item.value, 0, len);
+    Item item = heap_own(&vm->heap, pop(&vm->stack));
+    DataType type = ITEM_TYPE(item);
+    size_t address = heap_add_block(&vm->heap, type);
+    size_t len = sizes[type];
+    heap_reserve(&vm->heap, address, instr.arg * len);
+    heap_write(&vm->heap, address, item_to_raw(item), 0, len);
     
     for (uint32_t i = 1; i < instr.arg; i++) {
-        item = pop(&vm->stack);
-        heap_write(&vm->heap, address, item.value, i*len, len);
+        item = heap_own(&vm->heap, pop(&vm->stack));
+        heap_write(&vm->heap, address, item_to_raw(item), i*len, len);
     }
 
-    push(&vm->stack, (Item){ARRAY_TYPE, address});
+    push(&vm->stack, BOX(ARRAY_TYPE, address));
 }
 
 void handle_list_access(VM *vm, Instruction instr) {
-    uint32_t value, index; DataType array_type;
+    uint64_t value; uint32_t index; DataType array_type;
     size_t array_location, size_items;
 
     index = (instr.arg == (uint32_t) -1) ?
-        pop(&vm->stack).value : instr.arg;
+        AS_INT(pop(&vm->stack)) : instr.arg;
     
-    array_location = pop(&vm->stack).value;
-    array_type = vm->heap.table_type[array_location];
+    array_location = ITEM_BITS(pop(&vm->stack));
+    array_type = vm->heap.blocks[array_location].type;
     size_items = sizes[array_type];
 
     heap_read(&vm->heap, array_location, &value, index * size_items, size_items);
-    push(&vm->stack, (Item){array_type, value});
+    push(&vm->stack, item_from_raw(array_type, value));
 }
 
 void handle_list_set(VM *vm, Instruction instr) {
-    uint32_t value, index; DataType array_type;
+    uint64_t value; uint32_t index; DataType array_type;
     size_t array_location, size_items;
 
     index = (instr.arg == (uint32_t) -1) ?
-    pop(&vm->stack).value : instr.arg;
+        AS_INT(pop(&vm->stack)) : instr.arg;
     
-    array_location = pop(&vm->stack).value;
-    value = pop(&vm->stack).value;
-    array_type = vm->heap.table_type[array_location];
+    array_location = ITEM_BITS(pop(&vm->stack));
+    value = item_to_raw(heap_own(&vm->heap, pop(&vm->stack)));
+    array_type = vm->heap.blocks[array_location].type;
     size_items = sizes[array_type];
     
     heap_write(&vm->heap, array_location, value, index * size_items, size_items);
@@ -121,31 +153,70 @@ void handle_new(VM *vm, Instruction instr) {}
 
 // TODO: Implementar casting
 void handle_cast(VM *vm, Instruction instr) {
-    DataType from_type, to_type;
+    DataType to_type;
     uint8_t depth;
 
-    from_type = (instr.arg >> 8) & 0xFF;
+    // arg: (depth << 16) | (from type << 8) | to type, the item has its own type
     to_type = (instr.arg >> 0) & 0xFF;
     depth = (instr.arg >> 16) & 0xFF;
 
     Item item, result;
-    result.type = to_type;
     item = pop(&vm->stack);
+    result = BOX(to_type, 0);
 
     if (to_type == FLOAT_TYPE) {
-        result.value = format_float((float)(int32_t)item.value);
+        result = FROM_FLOAT(extract_float(item));
     } else if (to_type == INT_TYPE) {
-        result.value = (int) extract_float(item);
+        result = FROM_INT((int64_t) extract_float(item));
     } else if (to_type == BOOL_TYPE && depth == 0) {
-        result.value = (int8_t) item.value;
+        result = BOX(BOOL_TYPE, (int8_t) AS_INT(item));
     } else if (depth > 0) {
-        result.type = ARRAY_TYPE;
-        result.value = duplicate_heap_block(&vm->heap, item.value, to_type, depth);
+        result = BOX(ARRAY_TYPE, duplicate_heap_block(&vm->heap, ITEM_BITS(item), to_type, depth));
     }
     
     push(&vm->stack, result);
 }
 
+void handle_typed_alu(VM *vm, Instruction instr) {
+    Item right = pop(&vm->stack);
+    Item left = pop(&vm->stack);
+    push(&vm->stack, typed_alu(left, right, instr.opcode));
+}
+
+void handle_concat(VM *vm, Instruction instr) {
+    Item right = pop(&vm->stack);
+    Item left = pop(&vm->stack);
+#ifdef VM_DEBUG
+    if (!HAS_TAG(left, ARRAY_TYPE) && !HAS_TAG(right, ARRAY_TYPE)) handle_error(OPERAND_TYPE_MISMATCH);
+#endif
+    string_format_proc(vm, left, right);
+}
+
+void handle_inc_mem(VM *vm, Instruction instr) {
+    handle_load(vm, instr);
+    Item value = pop(&vm->stack);
+    push(&vm->stack, typed_alu(value, FROM_INT(1), OP_ADD_I));
+    handle_store_mem(vm, instr);
+}
+
+void handle_load_load_add(VM *vm, Instruction instr) {
+    handle_load(vm, (Instruction) { OP_LOAD, instr.arg >> 16 });
+    handle_load(vm, (Instruction) { OP_LOAD, instr.arg & 0xFFFF });
+    handle_typed_alu(vm, (Instruction) { OP_ADD_I, 0 });
+}
+
+void handle_cmp_jump_if_false(VM *vm, Instruction instr) {
+    Item right = pop(&vm->stack);
+    Item left = pop(&vm->stack);
+    if (!AS_BOOL(typed_alu(left, right, instr.arg >> 24)))
+        vm->pc = vm->bytecode + (instr.arg & 0xFFFFFF);
+}
+
+void handle_load_const_add(VM *vm, Instruction instr) {
+    Item value = pop(&vm->stack);
+    push(&vm->stack, typed_alu(value, FROM_INT((int32_t) instr.arg), OP_ADD_I));
+}
+
 // TODO: ¿Podremos quitarnoslo de encima? Lo dudo, pero se intentará
 void handle_objcall(VM *vm, Instruction instr) {}
 
@@ -0,0 +1,92 @@
+#include "../includes/output.h"
+#include "../includes/errors.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// The buffer flushed by handle_error and at exit
+static Output *active;
+
+static void flush_at_exit(void) {
+    output_flush_all();
+}
+
+void output_init(Output *out, FILE *file, size_t capacity, int unbuffered) {
+    static int registered;
+
+    out->capacity = capacity ? capacity : 1;
+    out->data = malloc(out->capacity);
+    if (!out->data) handle_error(UNDEFINED_ERROR);
+    out->size = 0;
+    out->unbuffered = unbuffered;
+    out->file = file;
+
+    active = out;
+    if (!registered) registered = !atexit(flush_at_exit);
+}
+
+void output_destroy(Output *out) {
+    output_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->capacity = 0;
+    if (active == out) active = NULL;
+}
+
+void output_flush(Output *out) {
+    if (out->size) fwrite(out->data, 1, out->size, out->file);
+    out->size = 0;
+    fflush(out->file);
+}
+
+void output_flush_all(void) {
+    if (active) output_flush(active);
+}
+
+// Writes larger than the buffer skip it after flushing what is pending
+void output_write(Output *out, const void *data, size_t bytes) {
+    if (bytes > out->capacity - out->size) {
+        output_flush(out);
+        if (bytes > out->capacity) {
+            fwrite(data, 1, bytes, out->file);
+            return;
+        }
+    }
+
+    memcpy(out->data + out->size, data, bytes);
+    out->size += bytes;
+}
+
+void output_int(Output *out, int64_t value) {
+    char buffer[32];
+    output_write(out, buffer, format_int(buffer, value));
+}
+
+void output_float(Output *out, double value) {
+    char buffer[32];
+    output_write(out, buffer, format_float(buffer, value));
+}
+
+size_t format_int(char *buffer, int64_t value) {
+    char digits[20];
+    size_t count = 0, length = 0;
+    uint64_t magnitude = (value < 0) ? -(uint64_t) value : (uint64_t) value;
+
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+
+    if (value < 0) buffer[length++] = '-';
+    while (count) buffer[length++] = digits[--count];
+    return length;
+}
+
+// Same text as "%g". Integral values below 1e6 print without exponent or
+// fraction under %g, so they take the integer path.
+size_t format_float(char *buffer, double value) {
+    if (fabs(value) < 1e6 && value == (double) (int64_t) value && !(value == 0 && signbit(value)))
+        return format_int(buffer, (int64_t) value);
+
+    return sprintf(buffer, "%g", value);
+}
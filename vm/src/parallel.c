@@ -0,0 +1,274 @@
+#include "../includes/parallel.h"
+#include "../includes/opcode_handlers.h"
+#include "../includes/opcodes.h"
+#include "../includes/jit.h"
+#include <pthread.h>
+
+#define PURITY_UNKNOWN 0
+#define PURITY_PURE    1
+#define PURITY_IMPURE  2
+
+typedef struct {
+    Pool *pool;
+    VM vm;
+    Jit jit;                   // The caller's compiled code, shared read-only
+    pthread_t thread;
+} Worker;
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;      // A new job, or stop
+    pthread_cond_t done;       // The last worker finished the job
+    unsigned long generation;  // Bumped for every job
+    int running;               // Threads still working on the job
+    int stop;
+
+    // The job: results[i] = function(element i)
+    uint32_t function;
+    const uint8_t *data;
+    DataType type;
+    size_t count;
+    Item *results;
+
+    int size;                  // Threads, the caller's included as workers[0]
+    Worker *workers;
+    uint8_t *purity;           // Per bytecode offset, for the functions asked about
+};
+
+// Pure code only computes on its stack and locals, reads globals and scalar
+// constants and calls other pure code: no heap opcodes, global writes,
+// syscalls or calls through function values. Storing an array constant
+// gives it its own header (heap_own), so array constants are out, and
+// generic arithmetic on an array concatenates strings, so it only counts
+// while no global can bring an array onto the stack. Workers never allocate.
+static int is_pure(const VM *vm, uint32_t start) {
+    size_t size = vm->program_size, count = 0;
+    uint8_t *seen = calloc(size, 1);
+    uint32_t *pending = malloc(sizeof(uint32_t) * size);
+    if (!seen || !pending) handle_error(UNDEFINED_ERROR);
+
+    int pure = 1, generic = 0, arrays = 0;
+    pending[count++] = start;
+    seen[start] = 1;
+
+    while (count > 0 && pure) {
+        uint32_t offset = pending[--count], next[2];
+        Instruction instr = vm->bytecode[offset];
+        int successors = 0, falls_through = 1;
+
+        switch (instr.opcode) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_EQ: case OP_NEQ: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+                generic = 1;
+                break;
+            case OP_LOAD:
+                arrays = 1;
+                break;
+            case OP_LOAD_CONST:
+                if (HAS_TAG(vm->constants[instr.arg], ARRAY_TYPE)) pure = 0;
+                break;
+            case OP_AND: case OP_OR: case OP_NOT:
+            case OP_STORE: case OP_STORE_BYTE: case OP_STORE_FLOAT: case OP_STORE_CHAR:
+            case OP_LOAD_LOCAL: case OP_STORE_LOCAL: case OP_ENTER:
+            case OP_LOAD_LOAD_ADD: case OP_LOAD_CONST_ADD:
+                break;
+            case OP_JUMP:
+                falls_through = 0;
+                next[successors++] = instr.arg;
+                break;
+            case OP_JUMP_IF:
+            case OP_CALL_DIRECT:
+                next[successors++] = instr.arg;
+                break;
+            case OP_CMP_JUMP_IF_FALSE:
+                next[successors++] = instr.arg & 0xFFFFFF;
+                break;
+            case OP_TAIL_CALL:
+                falls_through = 0;
+                next[successors++] = instr.arg;
+                break;
+            case OP_RETURN:
+                falls_through = 0;
+                break;
+            default:
+                // Typed arithmetic and comparisons never touch the heap
+                if (instr.opcode < OP_ADD_I || instr.opcode > OP_GE_F) pure = 0;
+                break;
+        }
+
+        if (falls_through) next[successors++] = offset + 1;
+        for (int i = 0; i < successors; i++) {
+            if (next[i] < size && !seen[next[i]]) {
+                seen[next[i]] = 1;
+                pending[count++] = next[i];
+            }
+        }
+    }
+
+    free(seen);
+    free(pending);
+    return pure && !(generic && arrays);
+}
+
+static void run_chunk(Pool *pool, int index) {
+    VM *vm = &pool->workers[index].vm;
+    size_t item_size = sizes[pool->type];
+    size_t from = pool->count * index / pool->size;
+    size_t to = pool->count * (index + 1) / pool->size;
+
+    for (size_t i = from; i < to; i++) {
+        uint64_t raw = 0;
+        memcpy(&raw, pool->data + i * item_size, item_size);
+        push(&vm->stack, item_from_raw(pool->type, raw));
+        vm_call(vm, pool->function);
+        pool->results[i] = pop(&vm->stack);
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    Pool *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->generation;
+
+        pthread_mutex_unlock(&pool->lock);
+        run_chunk(pool, (int) (worker - pool->workers));
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->running == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static Pool *pool_create(const VM *vm, int size) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool) handle_error(UNDEFINED_ERROR);
+
+    pool->size = size;
+    pool->workers = calloc(size, sizeof(Worker));
+    pool->purity = calloc(vm->program_size, 1);
+    if (!pool->workers || !pool->purity) handle_error(UNDEFINED_ERROR);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < size; i++) {
+        Worker *worker = &pool->workers[i];
+        VM *local = &worker->vm;
+        worker->pool = pool;
+
+        stack_init(&local->stack);
+        locals_init(&local->locals, vm->locals.window);
+        local->max_depth = vm->max_depth;
+        local->frame_pointer = 0;
+        local->frame_capacity = (INITIAL_FRAMES < vm->max_depth) ? INITIAL_FRAMES : vm->max_depth;
+        local->frames = malloc(sizeof(Frame) * local->frame_capacity);
+        if (!local->frames) handle_error(UNDEFINED_ERROR);
+
+        if (i > 0 && pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+            handle_error(UNDEFINED_ERROR);
+    }
+    return pool;
+}
+
+void pool_destroy(Pool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->size; i++) {
+        if (i > 0) pthread_join(pool->workers[i].thread, NULL);
+        locals_destroy(&pool->workers[i].vm.locals);
+        free(pool->workers[i].vm.frames);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->purity);
+    free(pool);
+}
+
+// What a worker shares with the caller, taken again for every job since
+// the heap's block table can move in between. Pure code never allocates,
+// so the workers' copy of the heap never asks for a collection. Workers run
+// the code the caller compiled but never count entries or compile, the
+// caller's JIT only changes between jobs.
+static void share_state(Worker *worker, const VM *vm) {
+    VM *local = &worker->vm;
+    local->program_size = vm->program_size;
+    local->bytecode = vm->bytecode;
+    local->constants = vm->constants;
+    local->constant_count = vm->constant_count;
+    local->globals = vm->globals;
+    local->heap = vm->heap;
+    local->heap.gc.pending = 0;
+    local->heap.gc.threshold = 0;
+    local->profile = NULL;
+    local->jit = NULL;
+#ifdef JIT_SUPPORTED
+    if (vm->jit) {
+        worker->jit = *vm->jit;
+        worker->jit.counters = NULL;
+        worker->jit.runs = 0;
+        local->jit = &worker->jit;
+    }
+#endif
+}
+
+int parallel_apply(VM *vm, uint32_t function, size_t address, Item *results) {
+    DataType type = vm->heap.blocks[address].type;
+    size_t item_size = sizes[type];
+    // Profiling counts every instruction on the caller's thread
+    if (vm->threads < 2 || vm->profile || function >= (uint32_t) vm->program_size) return 0;
+    if (type == ARRAY_TYPE || item_size == 0) return 0;
+
+    size_t bytes;
+    const uint8_t *data = heap_span(&vm->heap, address, &bytes);
+    if (bytes / item_size < PARALLEL_MIN_ELEMENTS) return 0;
+
+    if (!vm->pool) vm->pool = pool_create(vm, vm->threads);
+    Pool *pool = vm->pool;
+    if (pool->purity[function] == PURITY_UNKNOWN)
+        pool->purity[function] = is_pure(vm, function) ? PURITY_PURE : PURITY_IMPURE;
+    if (pool->purity[function] != PURITY_PURE) return 0;
+
+#ifdef JIT_SUPPORTED
+    if (vm->jit) jit_compile(vm, function, function + JIT_MAX_REGION - 1);
+#endif
+    for (int i = 0; i < pool->size; i++) share_state(&pool->workers[i], vm);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->function = function;
+    pool->data = data;
+    pool->type = type;
+    pool->count = bytes / item_size;
+    pool->results = results;
+    pool->running = pool->size - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunk(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+#ifdef JIT_SUPPORTED
+    if (vm->jit)
+        for (int i = 0; i < pool->size; i++) vm->jit->runs += pool->workers[i].jit.runs;
+#endif
+    return 1;
+}
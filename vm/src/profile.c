@@ -0,0 +1,295 @@
+#include "../includes/profile.h"
+#include "../includes/opcodes.h"
+#include "../includes/errors.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define PROFILE_TOP 10
+
+static const char *opcode_names[256] = {
+    [OP_HALT] = "HALT", [OP_ADD] = "ADD", [OP_SUB] = "SUB", [OP_MUL] = "MUL",
+    [OP_DIV] = "DIV", [OP_MOD] = "MOD", [OP_AND] = "AND", [OP_OR] = "OR",
+    [OP_NOT] = "NOT", [OP_EQ] = "EQ", [OP_NEQ] = "NEQ", [OP_LT] = "LT",
+    [OP_GT] = "GT", [OP_LE] = "LE", [OP_GE] = "GE",
+    [OP_STORE] = "STORE", [OP_STORE_BYTE] = "STORE_BYTE", [OP_STORE_FLOAT] = "STORE_FLOAT",
+    [OP_STORE_CHAR] = "STORE_CHAR", [OP_STORE_MEM] = "STORE_MEM", [OP_LOAD] = "LOAD",
+    [OP_JUMP] = "JUMP", [OP_JUMP_IF] = "JUMP_IF", [OP_CALL] = "CALL", [OP_RETURN] = "RETURN",
+    [OP_BUILD_LIST] = "BUILD_LIST", [OP_LIST_ACCESS] = "LIST_ACCESS", [OP_LIST_SET] = "LIST_SET",
+    [OP_DEFINE_TYPE] = "DEFINE_TYPE", [OP_NEW] = "NEW", [OP_CAST] = "CAST", [OP_GLOBALS] = "GLOBALS",
+    [OP_ADD_I] = "ADD_I", [OP_SUB_I] = "SUB_I", [OP_MUL_I] = "MUL_I", [OP_DIV_I] = "DIV_I",
+    [OP_MOD_I] = "MOD_I", [OP_ADD_F] = "ADD_F", [OP_SUB_F] = "SUB_F", [OP_MUL_F] = "MUL_F",
+    [OP_DIV_F] = "DIV_F", [OP_MOD_F] = "MOD_F",
+    [OP_EQ_I] = "EQ_I", [OP_NEQ_I] = "NEQ_I", [OP_LT_I] = "LT_I", [OP_GT_I] = "GT_I",
+    [OP_LE_I] = "LE_I", [OP_GE_I] = "GE_I",
+    [OP_EQ_F] = "EQ_F", [OP_NEQ_F] = "NEQ_F", [OP_LT_F] = "LT_F", [OP_GT_F] = "GT_F",
+    [OP_LE_F] = "LE_F", [OP_GE_F] = "GE_F",
+    [OP_CONCAT] = "CONCAT", [OP_LOAD_CONST] = "LOAD_CONST", [OP_CALL_DIRECT] = "CALL_DIRECT",
+    [OP_TAIL_CALL] = "TAIL_CALL", [OP_LOAD_LOCAL] = "LOAD_LOCAL", [OP_STORE_LOCAL] = "STORE_LOCAL",
+    [OP_ENTER] = "ENTER",
+    [OP_INC_MEM] = "INC_MEM", [OP_LOAD_LOAD_ADD] = "LOAD_LOAD_ADD",
+    [OP_CMP_JUMP_IF_FALSE] = "CMP_JUMP_IF_FALSE", [OP_LOAD_CONST_ADD] = "LOAD_CONST_ADD",
+    [OP_OBJCALL] = "OBJCALL", [OP_SYSCALL] = "SYSCALL",
+};
+
+const char *opcode_name(uint8_t opcode) {
+    return opcode_names[opcode] ? opcode_names[opcode] : "UNKNOWN";
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *zeroed(size_t count, size_t size) {
+    void *data = calloc(count ? count : 1, size);
+    if (!data) handle_error(UNDEFINED_ERROR);
+    return data;
+}
+
+void profile_init(Profile *profile, size_t size, const char *output) {
+    profile->size = size;
+    profile->counts = zeroed(size, sizeof(uint64_t));
+    profile->back_edges = zeroed(size, sizeof(uint64_t));
+    profile->calls = zeroed(size, sizeof(uint64_t));
+    profile->total_ms = zeroed(size, sizeof(double));
+    profile->self_ms = zeroed(size, sizeof(double));
+
+    profile->frame_capacity = 64;
+    profile->frames = zeroed(profile->frame_capacity, sizeof(ProfileFrame));
+    profile->depth = 0;
+
+    profile->previous = 0;
+    profile->previous_opcode = OP_HALT;
+    profile->start = now_ms();
+    profile->elapsed = 0;
+    profile->output = output;
+}
+
+void profile_destroy(Profile *profile) {
+    free(profile->counts);
+    free(profile->back_edges);
+    free(profile->calls);
+    free(profile->total_ms);
+    free(profile->self_ms);
+    free(profile->frames);
+    *profile = (Profile) { 0 };
+}
+
+static void enter_function(Profile *profile, uint32_t target) {
+    if (profile->depth == profile->frame_capacity) {
+        profile->frame_capacity *= 2;
+        ProfileFrame *frames = realloc(profile->frames, sizeof(ProfileFrame) * profile->frame_capacity);
+        if (!frames) handle_error(UNDEFINED_ERROR);
+        profile->frames = frames;
+    }
+
+    profile->calls[target]++;
+    profile->frames[profile->depth++] = (ProfileFrame) { target, now_ms(), 0 };
+}
+
+static void leave_function(Profile *profile, double now) {
+    if (profile->depth == 0) return;
+
+    ProfileFrame frame = profile->frames[--profile->depth];
+    double elapsed = now - frame.start;
+    profile->total_ms[frame.target] += elapsed;
+    profile->self_ms[frame.target] += elapsed - frame.callees;
+    if (profile->depth > 0) profile->frames[profile->depth - 1].callees += elapsed;
+}
+
+// Called before the instruction at `offset` runs. A CALL or RETURN right
+// before it means a function was entered or left, a jump to an earlier
+// offset closes a loop iteration.
+void profile_step(Profile *profile, uint32_t offset, uint8_t opcode) {
+    uint32_t previous = profile->previous;
+    profile->counts[offset]++;
+
+    switch (profile->previous_opcode) {
+        case OP_CALL:
+        case OP_CALL_DIRECT:
+            enter_function(profile, offset);
+            break;
+        case OP_RETURN:
+            leave_function(profile, now_ms());
+            break;
+        case OP_TAIL_CALL:
+            leave_function(profile, now_ms());
+            enter_function(profile, offset);
+            break;
+        case OP_JUMP:
+        case OP_JUMP_IF:
+        case OP_CMP_JUMP_IF_FALSE:
+            if (offset <= previous) profile->back_edges[previous]++;
+            break;
+    }
+
+    profile->previous = offset;
+    profile->previous_opcode = opcode;
+}
+
+// Closes the functions still running when the program halted
+void profile_finish(Profile *profile) {
+    double now = now_ms();
+    while (profile->depth > 0) leave_function(profile, now);
+    profile->elapsed = now - profile->start;
+}
+
+typedef struct {
+    uint32_t header;
+    uint32_t back_edge;
+    uint64_t iterations;
+    uint64_t instructions;    // Executions of the instructions between header and back edge
+} ProfileLoop;
+
+static const uint64_t *sort_keys;
+static const double *sort_times;
+
+static int by_count(const void *a, const void *b) {
+    uint64_t x = sort_keys[*(const uint32_t*) a], y = sort_keys[*(const uint32_t*) b];
+    return (x < y) - (x > y);
+}
+
+static int by_time(const void *a, const void *b) {
+    double x = sort_times[*(const uint32_t*) a], y = sort_times[*(const uint32_t*) b];
+    return (x < y) - (x > y);
+}
+
+static int by_instructions(const void *a, const void *b) {
+    uint64_t x = ((const ProfileLoop*) a)->instructions, y = ((const ProfileLoop*) b)->instructions;
+    return (x < y) - (x > y);
+}
+
+// Indices of the non-zero entries of `counts`, most executed first
+static size_t sorted_offsets(const uint64_t *counts, size_t size, uint32_t *order) {
+    size_t used = 0;
+    for (size_t i = 0; i < size; i++)
+        if (counts[i]) order[used++] = i;
+
+    sort_keys = counts;
+    qsort(order, used, sizeof(uint32_t), by_count);
+    return used;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+static void export_json(const Profile *profile, const Instruction *bytecode, uint64_t total,
+                        const uint64_t *opcodes, const uint32_t *offsets, size_t offset_count,
+                        const uint32_t *functions, size_t function_count,
+                        const ProfileLoop *loops, size_t loop_count) {
+    FILE *file = fopen(profile->output, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to write the profile to %s\n", profile->output);
+        return;
+    }
+
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"elapsed_ms\": %.3f,\n  \"opcodes\": {",
+        (unsigned long long) total, profile->elapsed);
+
+    const char *separator = "";
+    for (int op = 0; op < 256; op++) {
+        if (!opcodes[op]) continue;
+        fprintf(file, "%s\n    \"%s\": %llu", separator, opcode_name(op), (unsigned long long) opcodes[op]);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  },\n  \"offsets\": [");
+    for (size_t i = 0; i < offset_count; i++) {
+        uint32_t offset = offsets[i];
+        fprintf(file, "%s\n    {\"offset\": %u, \"opcode\": \"%s\", \"arg\": %u, \"count\": %llu}",
+            i ? "," : "", offset, opcode_name(bytecode[offset].opcode), bytecode[offset].arg,
+            (unsigned long long) profile->counts[offset]);
+    }
+
+    fprintf(file, "\n  ],\n  \"functions\": [");
+    for (size_t i = 0; i < function_count; i++) {
+        uint32_t target = functions[i];
+        fprintf(file, "%s\n    {\"target\": %u, \"calls\": %llu, \"total_ms\": %.3f, \"self_ms\": %.3f}",
+            i ? "," : "", target, (unsigned long long) profile->calls[target],
+            profile->total_ms[target], profile->self_ms[target]);
+    }
+
+    fprintf(file, "\n  ],\n  \"loops\": [");
+    for (size_t i = 0; i < loop_count; i++) {
+        fprintf(file, "%s\n    {\"header\": %u, \"back_edge\": %u, \"iterations\": %llu, \"instructions\": %llu}",
+            i ? "," : "", loops[i].header, loops[i].back_edge,
+            (unsigned long long) loops[i].iterations, (unsigned long long) loops[i].instructions);
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+}
+
+// Prints the hottest opcodes, instructions, functions and loops to `out` and
+// writes every counter to profile->output as JSON
+void profile_report(const Profile *profile, const Instruction *bytecode, FILE *out) {
+    size_t size = profile->size;
+    uint64_t opcodes[256] = { 0 }, total = 0;
+    uint64_t *prefix = zeroed(size + 1, sizeof(uint64_t));
+
+    for (size_t i = 0; i < size; i++) {
+        opcodes[bytecode[i].opcode] += profile->counts[i];
+        total += profile->counts[i];
+        prefix[i + 1] = prefix[i] + profile->counts[i];
+    }
+
+    uint32_t *offsets = zeroed(size, sizeof(uint32_t));
+    size_t offset_count = sorted_offsets(profile->counts, size, offsets);
+
+    uint32_t *functions = zeroed(size, sizeof(uint32_t));
+    size_t function_count = sorted_offsets(profile->calls, size, functions);
+    sort_times = profile->total_ms;
+    qsort(functions, function_count, sizeof(uint32_t), by_time);
+
+    ProfileLoop *loops = zeroed(size, sizeof(ProfileLoop));
+    size_t loop_count = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (!profile->back_edges[i]) continue;
+
+        uint32_t header = bytecode[i].arg;
+        if (bytecode[i].opcode == OP_CMP_JUMP_IF_FALSE) header &= 0xFFFFFF;
+        if (header > i) continue;
+        loops[loop_count++] = (ProfileLoop) {
+            header, i, profile->back_edges[i], prefix[i + 1] - prefix[header]
+        };
+    }
+    qsort(loops, loop_count, sizeof(ProfileLoop), by_instructions);
+
+    fprintf(out, "Profile: %llu instructions in %.3f ms\n", (unsigned long long) total, profile->elapsed);
+
+    uint32_t order[256];
+    size_t opcode_count = sorted_offsets(opcodes, 256, order);
+    fprintf(out, "Opcodes:\n");
+    for (size_t i = 0; i < opcode_count; i++)
+        fprintf(out, "  %-20s %14llu %6.2f%%\n", opcode_name(order[i]),
+            (unsigned long long) opcodes[order[i]], percent(opcodes[order[i]], total));
+
+    fprintf(out, "Hot instructions:\n");
+    for (size_t i = 0; i < offset_count && i < PROFILE_TOP; i++) {
+        uint32_t offset = offsets[i];
+        fprintf(out, "  @%-6u %-20s %10u %14llu %6.2f%%\n", offset, opcode_name(bytecode[offset].opcode),
+            bytecode[offset].arg, (unsigned long long) profile->counts[offset], percent(profile->counts[offset], total));
+    }
+
+    fprintf(out, "Functions:\n");
+    for (size_t i = 0; i < function_count && i < PROFILE_TOP; i++) {
+        uint32_t target = functions[i];
+        fprintf(out, "  @%-6u %10llu calls %12.3f ms total %12.3f ms self\n", target,
+            (unsigned long long) profile->calls[target], profile->total_ms[target], profile->self_ms[target]);
+    }
+
+    fprintf(out, "Hot loops:\n");
+    for (size_t i = 0; i < loop_count && i < PROFILE_TOP; i++)
+        fprintf(out, "  @%u..@%u %12llu iterations %14llu instructions %6.2f%%\n",
+            loops[i].header, loops[i].back_edge, (unsigned long long) loops[i].iterations,
+            (unsigned long long) loops[i].instructions, percent(loops[i].instructions, total));
+
+    export_json(profile, bytecode, total, opcodes, offsets, offset_count, functions, function_count, loops, loop_count);
+
+    free(prefix);
+    free(offsets);
+    free(functions);
+    free(loops);
+}
@@ -0,0 +1,100 @@
+#include "../includes/slab.h"
+#include "../includes/errors.h"
+#include <string.h>
+
+struct SlabChunk {
+    SlabChunk *next;
+};
+
+static int size_class(size_t size) {
+    int class = 0;
+    while (((size_t) 1 << (SLAB_MIN_SHIFT + class)) < size) class++;
+    return class;
+}
+
+// Splits a fresh page into chunks of one class and threads them on its free list
+static void refill(Slab *slab, int class) {
+    size_t chunk_size = (size_t) 1 << (SLAB_MIN_SHIFT + class);
+
+    if (slab->stats.pages == slab->page_capacity) {
+        slab->page_capacity = slab->page_capacity ? slab->page_capacity * 2 : 16;
+        void **new_pages = realloc(slab->pages, sizeof(void*) * slab->page_capacity);
+        if (!new_pages) handle_error(UNDEFINED_ERROR);
+        slab->pages = new_pages;
+    }
+
+    uint8_t *page = malloc(SLAB_PAGE_SIZE);
+    if (!page) handle_error(UNDEFINED_ERROR);
+    slab->pages[slab->stats.pages++] = page;
+    slab->stats.system_allocs++;
+
+    for (size_t offset = 0; offset + chunk_size <= SLAB_PAGE_SIZE; offset += chunk_size) {
+        SlabChunk *chunk = (SlabChunk*) (page + offset);
+        chunk->next = slab->free_chunks[class];
+        slab->free_chunks[class] = chunk;
+    }
+}
+
+// Returns at least `size` bytes, the usable size is stored in `capacity`
+void *slab_alloc(Slab *slab, size_t size, size_t *capacity) {
+    if (size > SLAB_MAX_SIZE) {
+        void *data = malloc(size);
+        if (!data) handle_error(UNDEFINED_ERROR);
+        slab->stats.large_allocs++;
+        slab->stats.system_allocs++;
+        *capacity = size;
+        return data;
+    }
+
+    int class = size_class(size);
+    if (!slab->free_chunks[class]) refill(slab, class);
+
+    SlabChunk *chunk = slab->free_chunks[class];
+    slab->free_chunks[class] = chunk->next;
+    slab->stats.slab_allocs++;
+    *capacity = (size_t) 1 << (SLAB_MIN_SHIFT + class);
+    return chunk;
+}
+
+// Moves the first `used` bytes to an allocation of at least `size` bytes
+void *slab_resize(Slab *slab, void *data, size_t used, size_t old_capacity, size_t size, size_t *capacity) {
+    if (data && old_capacity > SLAB_MAX_SIZE && size > SLAB_MAX_SIZE) {
+        void *new_data = realloc(data, size);
+        if (!new_data) handle_error(UNDEFINED_ERROR);
+        slab->stats.system_allocs++;
+        *capacity = size;
+        return new_data;
+    }
+
+    void *new_data = slab_alloc(slab, size, capacity);
+    if (used) memcpy(new_data, data, used);
+    slab_free(slab, data, old_capacity);
+    return new_data;
+}
+
+void slab_free(Slab *slab, void *data, size_t capacity) {
+    if (!data) return;
+    slab->stats.frees++;
+
+    if (capacity > SLAB_MAX_SIZE) {
+        free(data);
+        return;
+    }
+
+    int class = size_class(capacity);
+    SlabChunk *chunk = data;
+    chunk->next = slab->free_chunks[class];
+    slab->free_chunks[class] = chunk;
+}
+
+// Returns every page of this slab to the system, its chunks become invalid
+void slab_release(Slab *slab) {
+    for (size_t i = 0; i < slab->stats.pages; i++)
+        free(slab->pages[i]);
+
+    free(slab->pages);
+    slab->pages = NULL;
+    slab->page_capacity = 0;
+    slab->stats.pages = 0;
+    memset(slab->free_chunks, 0, sizeof(slab->free_chunks));
+}
@@ -1,26 +1,30 @@
 #include "../includes/stack.h"
+#include <inttypes.h>
+
+int string_format;
 
 void print_stack(const Stack stack) {
     printf("Stack: ");
-    for (int i = stack.top; i >= 0; i--) {
-        printf("[%d|%d], ", stack.data[i].type, stack.data[i].value);
+    for (int i = stack.top; i > 0; i--) {
+        printf("[%d|%" PRIu64 "], ", ITEM_TYPE(stack.data[i]), (uint64_t) ITEM_BITS(stack.data[i]));
     }
     printf("\n");
 }
 
 void stack_init(Stack* stack) {
-    stack->top = -1;
+    stack->data[0] = BOX(UNASSIGNED_TYPE, 0);
+    stack->top = 0;
 }
 
 void push(Stack *stack, Item item) {
-    if (stack->top >= STACK_SIZE)
+    if (stack->top >= STACK_SIZE - 1)
         handle_error(STACK_OVERFLOW);
 
     stack->data[++stack->top] = item;
 }
 
 Item pop(Stack *stack) {
-    if (stack->top < 0)
+    if (stack->top <= 0)
         handle_error(STACK_UNDERFLOW);
 
     return stack->data[stack->top--];
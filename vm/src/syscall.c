@@ -1,82 +1,98 @@
 #include "../includes/syscall.h"
+#include "../includes/parallel.h"
+#include <inttypes.h>
 
 void built_in_exit(VM *vm) { exit(EXIT_SUCCESS); }
 
-void built_in_subprint(Item item, FILE *out) {
-    if (item.type == INT_TYPE) {
-        fprintf(out, "%d", (int) item.value);
-    } else if (item.type == BOOL_TYPE) {
-        if (item.value == 1)
-            fprintf(out, "True");
-        else if (item.value == 0)
-            fprintf(out, "False");
+// Copies a CHAR block into `buffer`, which must hold its size + 1 bytes
+static void copy_c_string(Heap *heap, size_t address, char *buffer) {
+    size_t length;
+    uint8_t *data = heap_span(heap, address, &length);
+    if (length) memcpy(buffer, data, length);
+    buffer[length] = '\0';
+}
+
+void built_in_subprint(Item item, Output *out) {
+    DataType type = ITEM_TYPE(item);
+
+    if (type == INT_TYPE) {
+        output_int(out, AS_INT(item));
+    } else if (type == BOOL_TYPE) {
+        if (ITEM_BITS(item) == 1)
+            output_write(out, "True", 4);
+        else if (ITEM_BITS(item) == 0)
+            output_write(out, "False", 5);
         else
-            fprintf(out, "%d", (int8_t) item.value);
-    } else if (item.type == FLOAT_TYPE) {
-        fprintf(out, "%g", extract_float(item));
-    } else if (item.type == CHAR_TYPE) {
-        fprintf(out, "%c", item.value);
+            output_int(out, (int8_t) ITEM_BITS(item));
+    } else if (type == FLOAT_TYPE) {
+        output_float(out, AS_FLOAT(item));
+    } else if (type == CHAR_TYPE) {
+        output_char(out, (char) ITEM_BITS(item));
     }
 }
 
-void built_in_print(VM *vm) {
-    Item element = pop(&vm->stack);
-
-    if (element.type == ARRAY_TYPE) {
-        Item item;
-        Memory arr = vm->heap.blocks[element.value];
-        DataType arr_type = vm->heap.table_type[element.value];
-        
-        if (arr_type == CHAR_TYPE) {
-            for (int i = 0; i < arr.size; i++) {
-                item = (Item){ arr_type, arr.data[i] };
-                built_in_subprint(item, stdout);
-            }
-        } else {
-            printf("[");
-            for (int i = 0; i < arr.size/sizes[arr_type]; i++) {
-                uint32_t value;
-                heap_read(&vm->heap, element.value, &value, i * sizes[arr_type], sizes[arr_type]);
-                item = (Item){ arr_type, value }; 
-                push(&vm->stack, item);
-                built_in_print(vm);
-                if (i != arr.size/sizes[arr_type] - 1) printf(", ");
-            }
-            printf("]");
-        }
-    } else {
-        built_in_subprint(element, stdout);
+// CHAR arrays are written in one copy, other arrays element by element,
+// recursing only into nested arrays
+static void print_item(VM *vm, Item item) {
+    if (!HAS_TAG(item, ARRAY_TYPE)) {
+        built_in_subprint(item, &vm->output);
+        return;
+    }
+
+    size_t address = ITEM_BITS(item);
+    DataType arr_type = vm->heap.blocks[address].type;
+    size_t item_size = sizes[arr_type];
+    size_t length;
+
+    if (arr_type == CHAR_TYPE || item_size == 0) {
+        uint8_t *data = heap_span(&vm->heap, address, &length);
+        if (arr_type == CHAR_TYPE) output_write(&vm->output, data, length);
+        return;
+    }
+
+    size_t count = vm->heap.blocks[address].size / item_size;
+    output_char(&vm->output, '[');
+    for (size_t i = 0; i < count; i++) {
+        uint64_t value;
+        heap_read(&vm->heap, address, &value, i * item_size, item_size);
+        print_item(vm, item_from_raw(arr_type, value));
+        if (i != count - 1) output_write(&vm->output, ", ", 2);
     }
+    output_char(&vm->output, ']');
+}
+
+void built_in_print(VM *vm) {
+    print_item(vm, pop(&vm->stack));
+    if (vm->output.unbuffered) output_flush(&vm->output);
 }
 
 void built_in_input(VM *vm) {
-    Item input = {INT_TYPE, 0};
-    scanf("%d", &input.value);
-    push(&vm->stack, input);
+    int64_t input = 0;
+    output_flush(&vm->output);
+    scanf("%" SCNd64, &input);
+    push(&vm->stack, FROM_INT(input));
 }
 
 void built_in_getf(VM *vm) {
-    float aux;
-    scanf("%g", &aux);
-    push(&vm->stack, (Item){FLOAT_TYPE, format_float(aux)});
+    double aux = 0;
+    output_flush(&vm->output);
+    scanf("%lg", &aux);
+    push(&vm->stack, FROM_FLOAT(aux));
 }
 
 void built_in_scan(VM *vm) {
     char input_str[2048];
+    output_flush(&vm->output);
     scanf("%2047s", input_str);
 
     size_t address = heap_add_block(&vm->heap, CHAR_TYPE);
-    for (int i = 0; i < 2048 && input_str[i] != '\0'; i++)
-        heap_write(&vm->heap, address, input_str[i], i, 1);
+    heap_fill(&vm->heap, address, 0, input_str, strlen(input_str));
     
-    push(&vm->stack, (Item) {
-        ARRAY_TYPE,
-        address
-    });
+    push(&vm->stack, BOX(ARRAY_TYPE, address));
 }
 
 void built_in_type(VM *vm) {
-    DataType arg_type = pop(&vm->stack).type;
+    DataType arg_type = ITEM_TYPE(pop(&vm->stack));
     size_t address = heap_add_block(&vm->heap, CHAR_TYPE);
 
     char* get_type[ARRAY_TYPE + 1] = {
@@ -84,53 +100,42 @@ void built_in_type(VM *vm) {
         "CHAR", "ARRAY"
     };
 
-    for (int i = 0; get_type[arg_type][i] != '\0'; i++)
-        heap_write(&vm->heap, address, get_type[arg_type][i], i, 1);
+    heap_fill(&vm->heap, address, 0, get_type[arg_type], strlen(get_type[arg_type]));
 
-    push(&vm->stack, (Item) {
-        ARRAY_TYPE,
-        address
-    });
+    push(&vm->stack, BOX(ARRAY_TYPE, address));
 }
 
 void built_in_read(VM *vm) {
     FILE *file;
     int from, bytes_to_read;
 
-    uint32_t filename_address = pop(&vm->stack).value;
-    int length = vm->heap.blocks[filename_address].size;
-
-    char filename[length + 1];
-    for (int i = 0; i < length; i++) {
-        uint32_t aux;
-        heap_read(&vm->heap, filename_address, &aux, i, 1);
-        filename[i] = (char) aux;
-    }
-    filename[length] = '\0';
+    uint32_t filename_address = ITEM_BITS(pop(&vm->stack));
+    char filename[vm->heap.blocks[filename_address].size + 1];
+    copy_c_string(&vm->heap, filename_address, filename);
     file = fopen(filename, "rb");
     if (file == NULL) handle_error(FILE_NOT_FOUND);
 
-    from = pop(&vm->stack).value;
-    bytes_to_read = pop(&vm->stack).value;
+    from = AS_INT(pop(&vm->stack));
+    bytes_to_read = AS_INT(pop(&vm->stack));
 
-    uint8_t aux;
     fseek(file, 0, SEEK_END);
     int file_length = ftell(file);
     if (from < 0) from = file_length - (from + 1);
     fseek(file, from, SEEK_SET);
 
-    int read_pointer = from;
+    // The whole range lands in the block with a single fread
     int address = heap_add_block(&vm->heap, BOOL_TYPE);
-    while (fread(&aux, 1, 1, file) && read_pointer < from + bytes_to_read) {
-        heap_write(&vm->heap, address, aux, read_pointer - from, 1);
-        read_pointer++;
-    }
+    int available = file_length - from;
+    size_t count = (bytes_to_read < available) ? bytes_to_read : available;
+    if (bytes_to_read < 0 || available < 0) count = 0;
+
+    size_t length;
+    heap_resize(&vm->heap, address, count);
+    uint8_t *data = heap_span(&vm->heap, address, &length);
+    heap_resize(&vm->heap, address, count ? fread(data, 1, count, file) : 0);
 
     fclose(file);
-    push(&vm->stack, (Item) {
-        ARRAY_TYPE,
-        address
-    });
+    push(&vm->stack, BOX(ARRAY_TYPE, address));
 }
 
 void built_in_write(VM *vm) {
@@ -138,53 +143,42 @@ void built_in_write(VM *vm) {
     uint32_t filename_address, value_address;
     uint32_t bytes_to_write, overwrite;
 
-    filename_address = pop(&vm->stack).value;
-    int length = vm->heap.blocks[filename_address].size;
-
-    char filename[length + 1];
-    for (int i = 0; i < length; i++) {
-        uint32_t aux;
-        heap_read(&vm->heap, filename_address, &aux, i, 1);
-        filename[i] = (char) aux;
-    }
+    filename_address = ITEM_BITS(pop(&vm->stack));
+    char filename[vm->heap.blocks[filename_address].size + 1];
+    copy_c_string(&vm->heap, filename_address, filename);
 
-    value_address = pop(&vm->stack).value;
-    bytes_to_write = pop(&vm->stack).value;
-    overwrite = pop(&vm->stack).value;
+    value_address = ITEM_BITS(pop(&vm->stack));
+    bytes_to_write = AS_INT(pop(&vm->stack));
+    overwrite = AS_BOOL(pop(&vm->stack));
 
-    filename[length] = '\0';
     file = fopen(filename, (overwrite != (uint32_t) 0) ? "wb" : "ab");
     if (file == NULL) handle_error(FILE_NOT_FOUND);
 
-    size_t i;
-    uint8_t buffer; uint32_t buffer4;
-    for (i = 0; i < bytes_to_write; i++) {
-        heap_read(&vm->heap, value_address, &buffer4, i, 1);
-        buffer = (uint8_t) buffer4;
-        fwrite(&buffer, 1, 1, file);
-    }
+    size_t length;
+    uint8_t *data = heap_span(&vm->heap, value_address, &length);
+    if (bytes_to_write > length) handle_error(MEMORY_ACCESS_OUT_OF_BOUNDS);
+
+    size_t written = fwrite(data, 1, bytes_to_write, file);
+    fclose(file);
 
-    push(&vm->stack, (Item) {
-        INT_TYPE,
-        i
-    });
+    push(&vm->stack, FROM_INT(written));
 }
 
 void built_in_size(VM* vm) {
-    Item arr = pop(&vm->stack);
-    push(&vm->stack, (Item) {
-        INT_TYPE,
-        vm->heap.blocks[arr.value].size
-    });
+    size_t address = ITEM_BITS(pop(&vm->stack));
+    size_t item_size = sizes[vm->heap.blocks[address].type];
+    push(&vm->stack, FROM_INT(vm->heap.blocks[address].size / (item_size ? item_size : 1)));
 }
 
 void built_in_append(VM* vm) {
     Item arr, item;
     arr = pop(&vm->stack);
-    item = pop(&vm->stack);
-    if (item.type != vm->heap.table_type[arr.value]) handle_error(UNDEFINED_ERROR);
+    item = heap_own(&vm->heap, pop(&vm->stack));
+    size_t address = ITEM_BITS(arr);
+    DataType arr_type = vm->heap.blocks[address].type;
+    if (ITEM_TYPE(item) != arr_type) handle_error(UNDEFINED_ERROR);
 
-    heap_write(&vm->heap, arr.value, item.value, vm->heap.blocks[arr.value].size, sizes[arr.type]);
+    heap_write(&vm->heap, address, item_to_raw(item), vm->heap.blocks[address].size, sizes[arr_type]);
 }
 
 // TODO: Para implementar
@@ -192,107 +186,282 @@ void built_in_remove_at(VM* vm) {
     Item arr, index;
     arr = pop(&vm->stack); index = pop(&vm->stack);
 
-    if (index.value < 0 || index.value > vm->heap.blocks[arr.value].size)
+    size_t address = ITEM_BITS(arr);
+    if (AS_INT(index) < 0 || AS_INT(index) > vm->heap.blocks[address].size)
         handle_error(INDEX_OUT_OF_BOUNDS);
     
-    DataType arr_type = vm->heap.table_type[arr.value];
-    heap_remove_element(&vm->heap, arr.value, index.value, sizes[arr_type]);
+    DataType arr_type = vm->heap.blocks[address].type;
+    heap_remove_element(&vm->heap, address, AS_INT(index), sizes[arr_type]);
 }
 
 void built_in_is_empty(VM* vm) {
     Item arr = pop(&vm->stack);
     
-    Item result = {
-        BOOL_TYPE,
-        (vm->heap.blocks[arr.value].size == 0) ? 1 : 0
-    };
-
-    push(&vm->stack, result);
+    push(&vm->stack, BOX(BOOL_TYPE, vm->heap.blocks[ITEM_BITS(arr)].size == 0));
 }
 
 void built_in_slice(VM* vm) {
     
 }
 
-// TODO: 
+static size_t array_address(Item arr) {
+    if (!HAS_TAG(arr, ARRAY_TYPE)) handle_error(OPERAND_TYPE_MISMATCH);
+    return ITEM_BITS(arr);
+}
+
+static Item element_at(VM *vm, size_t address, DataType type, size_t index) {
+    uint64_t raw = 0;
+    heap_read(&vm->heap, address, &raw, index * sizes[type], sizes[type]);
+    return item_from_raw(type, raw);
+}
+
+static size_t element_count(VM *vm, size_t address) {
+    size_t item_size = sizes[vm->heap.blocks[address].type];
+    return item_size ? vm->heap.blocks[address].size / item_size : 0;
+}
+
+// Calls the function value `func` from inside the syscall, the arguments
+// pushed last to first
+static Item call_value(VM *vm, Item func, int argc, const Item *args) {
+    for (int i = argc - 1; i >= 0; i--) push(&vm->stack, args[i]);
+    vm_call(vm, ITEM_BITS(func));
+    return pop(&vm->stack);
+}
+
+// Stores `result` as element `index` of the output block, which took the
+// type of the first result. Scalars of another type are converted.
+static void store_result(VM *vm, size_t out, size_t index, Item result) {
+    DataType type = vm->heap.blocks[out].type;
+    uint64_t raw = item_to_raw(heap_own(&vm->heap, result));
+    DataType result_type = ITEM_TYPE(result);
+
+    if (result_type != type) {
+        if (result_type == ARRAY_TYPE || type == ARRAY_TYPE) handle_error(OPERAND_TYPE_MISMATCH);
+        raw = convert_raw(raw, result_type, type);
+    }
+    heap_write(&vm->heap, out, raw, index * sizes[type], sizes[type]);
+}
+
+// Output block with room for `count` results, typed after the first one.
+// Results are appended, so the collector never sees unwritten elements.
+static size_t result_block(VM *vm, Item first, size_t count) {
+    DataType type = ITEM_TYPE(first);
+    size_t out = heap_add_block(&vm->heap, type);
+    heap_reserve(&vm->heap, out, count * sizes[type]);
+    store_result(vm, out, 0, first);
+    return out;
+}
+
+// map(arr, f): a new array of f(x) for every element. Pure functions over
+// large scalar arrays run on the worker threads (parallel.h), the others
+// here one element at a time, with the array and the output kept on the
+// stack so collections during the calls see them.
 void built_in_map(VM* vm) {
-    Item arr, func_dir;
-    arr = pop(&vm->stack); func_dir = pop(&vm->stack);
+    Item arr = pop(&vm->stack), func = pop(&vm->stack);
+    size_t address = array_address(arr), count = element_count(vm, address);
 
+    if (count == 0) {
+        push(&vm->stack, BOX(ARRAY_TYPE, heap_add_block(&vm->heap, vm->heap.blocks[address].type)));
+        return;
+    }
+
+    Item *results = malloc(sizeof(Item) * count);
+    if (!results) handle_error(UNDEFINED_ERROR);
+    if (parallel_apply(vm, ITEM_BITS(func), address, results)) {
+        size_t out = result_block(vm, results[0], count);
+        for (size_t i = 1; i < count; i++) store_result(vm, out, i, results[i]);
+        free(results);
+        push(&vm->stack, BOX(ARRAY_TYPE, out));
+        return;
+    }
+    free(results);
+
+    DataType type = vm->heap.blocks[address].type;
     push(&vm->stack, arr);
+    Item element = element_at(vm, address, type, 0);
+    size_t out = result_block(vm, call_value(vm, func, 1, &element), count);
+    push(&vm->stack, BOX(ARRAY_TYPE, out));
+
+    for (size_t i = 1; i < count; i++) {
+        element = element_at(vm, address, type, i);
+        store_result(vm, out, i, call_value(vm, func, 1, &element));
+    }
+
+    Item result = pop(&vm->stack);
+    pop(&vm->stack);
+    push(&vm->stack, result);
 }
 
+// filter(arr, f): a new array of the elements for which f returns true
 void built_in_filter(VM* vm) {
-    Item arr, func_dir;
-    arr = pop(&vm->stack); func_dir = pop(&vm->stack);
+    Item arr = pop(&vm->stack), func = pop(&vm->stack);
+    size_t address = array_address(arr), count = element_count(vm, address);
+    DataType type = vm->heap.blocks[address].type;
+    size_t item_size = sizes[type], kept = 0;
+
+    size_t out = heap_add_block(&vm->heap, type);
+    heap_reserve(&vm->heap, out, count * item_size);
+
+    Item *results = count ? malloc(sizeof(Item) * count) : NULL;
+    if (count && !results) handle_error(UNDEFINED_ERROR);
+    if (count && parallel_apply(vm, ITEM_BITS(func), address, results)) {
+        for (size_t i = 0; i < count; i++) {
+            if (AS_BOOL(results[i])) store_result(vm, out, kept++, element_at(vm, address, type, i));
+        }
+    } else {
+        push(&vm->stack, arr);
+        push(&vm->stack, BOX(ARRAY_TYPE, out));
+        for (size_t i = 0; i < count; i++) {
+            Item element = element_at(vm, address, type, i);
+            if (AS_BOOL(call_value(vm, func, 1, &element))) store_result(vm, out, kept++, element);
+        }
+        pop(&vm->stack);
+        pop(&vm->stack);
+    }
+    free(results);
 
-    push(&vm->stack, arr);
+    push(&vm->stack, BOX(ARRAY_TYPE, out));
 }
 
-void built_in_min(VM* vm) {
-    Item arr = pop(&vm->stack);
-    size_t block_index = arr.value;
-    DataType arr_type = vm->heap.table_type[block_index];
-    Memory* block = &vm->heap.blocks[block_index];
-
-    size_t elem_size = sizes[arr_type];
-    size_t total_elems = block->size / elem_size;
-
-    uint32_t min_value;
-    heap_read(&vm->heap, block_index, &min_value, 0, elem_size);
-
-    for (size_t i = 1; i < total_elems; i++) {
-        uint32_t buffer;
-        heap_read(&vm->heap, block_index, &buffer, i * elem_size, elem_size);
-
-        if (arr_type == FLOAT_TYPE) {
-            float current = extract_float((Item){FLOAT_TYPE, buffer});
-            float current_min = extract_float((Item){FLOAT_TYPE, min_value});
-            if (current < current_min) {
-                min_value = buffer;
-            }
-        } else {
-            if (buffer < min_value) {
-                min_value = buffer;
-            }
-        }
+// reduce(arr, f, initial): f(f(initial, arr[0]), arr[1])... in order, so
+// always on this thread
+void built_in_reduce(VM* vm) {
+    Item arr = pop(&vm->stack), func = pop(&vm->stack);
+    Item args[2] = { pop(&vm->stack) };
+    size_t address = array_address(arr), count = element_count(vm, address);
+    DataType type = vm->heap.blocks[address].type;
+
+    push(&vm->stack, arr);
+    for (size_t i = 0; i < count; i++) {
+        args[1] = element_at(vm, address, type, i);
+        args[0] = call_value(vm, func, 2, args);
     }
+    pop(&vm->stack);
 
-    push(&vm->stack, (Item){arr_type, min_value});
+    push(&vm->stack, args[0]);
 }
 
-void built_in_max(VM* vm) {
-    Item arr = pop(&vm->stack);
-    size_t block_index = arr.value;
-    DataType arr_type = vm->heap.table_type[block_index];
-    Memory* block = &vm->heap.blocks[block_index];
-
-    size_t elem_size = sizes[arr_type];
-    size_t total_elems = block->size / elem_size;
-
-    uint32_t max_value;
-    heap_read(&vm->heap, block_index, &max_value, 0, elem_size);
-
-    for (size_t i = 1; i < total_elems; i++) {
-        uint32_t buffer;
-        heap_read(&vm->heap, block_index, &buffer, i * elem_size, elem_size);
-
-        if (arr_type == FLOAT_TYPE) {
-            float current = extract_float((Item){FLOAT_TYPE, buffer});
-            float current_min = extract_float((Item){FLOAT_TYPE, max_value});
-            if (current > current_min) {
-                max_value = buffer;
-            }
-        } else {
-            if (buffer > max_value) {
-                max_value = buffer;
-            }
+// Index of the first smallest (largest with `max`) element, -1 when empty.
+// INT and FLOAT blocks go through the vector kernels, the other element
+// types compare their raw bytes as unsigned integers.
+static int64_t arg_extreme(VM *vm, size_t address, int max) {
+    DataType type = vm->heap.blocks[address].type;
+    size_t elem_size = sizes[type], bytes;
+    const uint8_t *data = heap_span(&vm->heap, address, &bytes);
+    size_t count = elem_size ? bytes / elem_size : 0;
+
+    if (count == 0) return -1;
+    if (type == INT_TYPE) return kernel_arg_int((const uint64_t*) data, count, max);
+    if (type == FLOAT_TYPE) return kernel_arg_float((const double*) data, count, max);
+
+    size_t best = 0;
+    uint64_t best_value = 0;
+    memcpy(&best_value, data, elem_size);
+    for (size_t i = 1; i < count; i++) {
+        uint64_t value = 0;
+        memcpy(&value, data + i * elem_size, elem_size);
+        if (max ? value > best_value : value < best_value) {
+            best = i;
+            best_value = value;
         }
     }
+    return best;
+}
+
+static void push_extreme(VM *vm, int max) {
+    size_t address = array_address(pop(&vm->stack));
+    int64_t index = arg_extreme(vm, address, max);
+    if (index < 0) handle_error(INDEX_OUT_OF_BOUNDS);
+
+    DataType arr_type = vm->heap.blocks[address].type;
+    uint64_t value = 0;
+    heap_read(&vm->heap, address, &value, index * sizes[arr_type], sizes[arr_type]);
+    push(&vm->stack, item_from_raw(arr_type, value));
+}
+
+void built_in_min(VM* vm) { push_extreme(vm, 0); }
+void built_in_max(VM* vm) { push_extreme(vm, 1); }
+
+void built_in_argmin(VM* vm) {
+    push(&vm->stack, FROM_INT(arg_extreme(vm, array_address(pop(&vm->stack)), 0)));
+}
 
-    push(&vm->stack, (Item){arr_type, max_value});
+void built_in_argmax(VM* vm) {
+    push(&vm->stack, FROM_INT(arg_extreme(vm, array_address(pop(&vm->stack)), 1)));
 }
 
+// Payload of an INT or FLOAT block, `count` elements of 8 bytes
+static const uint64_t *numeric_span(VM *vm, Item arr, DataType *type, size_t *count) {
+    size_t address = array_address(arr), bytes;
+    *type = vm->heap.blocks[address].type;
+    if (*type != INT_TYPE && *type != FLOAT_TYPE) handle_error(OPERAND_TYPE_MISMATCH);
+
+    const uint8_t *data = heap_span(&vm->heap, address, &bytes);
+    *count = bytes / sizeof(uint64_t);
+    return (const uint64_t*) data;
+}
+
+// INT sums wrap like ADD_I
+void built_in_sum(VM* vm) {
+    DataType type;
+    size_t count;
+    const uint64_t *data = numeric_span(vm, pop(&vm->stack), &type, &count);
+
+    if (type == INT_TYPE) push(&vm->stack, FROM_INT(kernel_sum_int(data, count)));
+    else push(&vm->stack, FROM_FLOAT(kernel_sum_float((const double*) data, count)));
+}
+
+void built_in_mean(VM* vm) {
+    DataType type;
+    size_t count;
+    const uint64_t *data = numeric_span(vm, pop(&vm->stack), &type, &count);
+    if (count == 0) handle_error(DIVISION_BY_ZERO);
+
+    double sum = (type == INT_TYPE) ? (double) kernel_sum_int(data, count)
+                                    : kernel_sum_float((const double*) data, count);
+    push(&vm->stack, FROM_FLOAT(sum / count));
+}
+
+// Both arrays have the same numeric type and length
+static DataType numeric_pair(VM *vm, const uint64_t **a, const uint64_t **b, size_t *count) {
+    Item first = pop(&vm->stack), second = pop(&vm->stack);
+    DataType type, other;
+    size_t other_count;
+
+    *a = numeric_span(vm, first, &type, count);
+    *b = numeric_span(vm, second, &other, &other_count);
+    if (type != other) handle_error(OPERAND_TYPE_MISMATCH);
+    if (*count != other_count) handle_error(INDEX_OUT_OF_BOUNDS);
+    return type;
+}
+
+void built_in_dot(VM* vm) {
+    const uint64_t *a, *b;
+    size_t count;
+
+    if (numeric_pair(vm, &a, &b, &count) == INT_TYPE)
+        push(&vm->stack, FROM_INT(kernel_dot_int(a, b, count)));
+    else
+        push(&vm->stack, FROM_FLOAT(kernel_dot_float((const double*) a, (const double*) b, count)));
+}
+
+static void push_elementwise(VM *vm, KernelOp int_op, KernelOp float_op) {
+    const uint64_t *a, *b;
+    size_t count, bytes;
+    DataType type = numeric_pair(vm, &a, &b, &count);
+
+    // Adding the block doesn't move the payloads a and b point to
+    size_t address = heap_add_block(&vm->heap, type);
+    heap_resize(&vm->heap, address, count * sizeof(uint64_t));
+    uint64_t *out = (uint64_t*) heap_span(&vm->heap, address, &bytes);
+    kernel_elementwise(type == INT_TYPE ? int_op : float_op, out, a, b, count);
+
+    push(&vm->stack, BOX(ARRAY_TYPE, address));
+}
+
+void built_in_vec_add(VM* vm) { push_elementwise(vm, KERNEL_ADD_INT, KERNEL_ADD_FLOAT); }
+void built_in_vec_mul(VM* vm) { push_elementwise(vm, KERNEL_MUL_INT, KERNEL_MUL_FLOAT); }
+
 // TODO:
 void built_in_lower(VM* vm) {}
 void built_in_upper(VM* vm) {}
@@ -312,17 +481,25 @@ void (*builtins[])(VM *vm) = {
     built_in_append,
     built_in_remove_at,
     built_in_is_empty,
-    built_in_map,
     built_in_slice,
+    built_in_map,
     built_in_filter,
     built_in_min,
     built_in_max,
     built_in_lower,
     built_in_upper,
     built_in_toString,
+    built_in_sum,
+    built_in_mean,
+    built_in_dot,
+    built_in_argmin,
+    built_in_argmax,
+    built_in_vec_add,
+    built_in_vec_mul,
+    built_in_reduce,
 };
 
 void syscall(VM *vm, int arg) {
-    if (arg > -1 && arg < 20) builtins[arg](vm);
+    if (arg > -1 && arg < (int) (sizeof(builtins) / sizeof(builtins[0]))) builtins[arg](vm);
     else printf("Unknown syscall: %d\n", arg);
 }
\ No newline at end of file
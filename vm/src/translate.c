@@ -0,0 +1,299 @@
+#include "../includes/translate.h"
+#include "../includes/opcodes.h"
+#include "../includes/alu.h"
+#include <inttypes.h>
+#include <math.h>
+
+// The translated run() keeps the interpreter's locals (pc, sp, tos) and
+// uses the bodies from includes/interpreter.h, so every opcode behaves as in
+// vm_run. Jumps, CALL_DIRECT and TAIL_CALL become gotos to fixed labels.
+// CALL and RETURN go through `dispatch`, which jumps to the label of the
+// destination through the entries table: function addresses (STORE
+// arguments that are valid offsets) and return addresses. Any other
+// destination is handed to vm_run.
+
+static uint8_t *read_program(const char *filename, size_t *bytes) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) handle_error(FILE_NOT_FOUND);
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0) handle_error(FILE_NOT_FOUND);
+
+    uint8_t *data = malloc(size ? size : 1);
+    if (!data) handle_error(UNDEFINED_ERROR);
+    if (fread(data, 1, size, file) != (size_t) size) handle_error(FILE_PERMISSION_ERROR);
+    fclose(file);
+
+    *bytes = size;
+    return data;
+}
+
+static void emit_image(FILE *out, const uint8_t *data, size_t bytes) {
+    fprintf(out, "static const uint8_t program_image[] = {");
+    for (size_t i = 0; i < bytes; i++)
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", data[i]);
+    fprintf(out, "%s};\n\n", bytes ? "\n" : " 0 ");
+}
+
+// A double as a C literal, FROM_FLOAT canonicalizes NaN at compile time
+static void emit_float(FILE *out, double value) {
+    if (isnan(value)) fprintf(out, "CANONICAL_NAN");
+    else if (isinf(value)) fprintf(out, "FROM_FLOAT(%sHUGE_VAL)", value < 0 ? "-" : "");
+    else fprintf(out, "FROM_FLOAT(%a)", value);
+}
+
+static const char *int_expression(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD_I: return "l + r";
+        case OP_SUB_I: return "l - r";
+        case OP_MUL_I: return "WRAPPING_MUL(l, r)";
+        case OP_DIV_I: return "int_div(l, r)";
+        case OP_MOD_I: return "int_mod(l, r)";
+        case OP_EQ_I:  case OP_EQ_F:  return "l == r";
+        case OP_NEQ_I: case OP_NEQ_F: return "l != r";
+        case OP_LT_I:  case OP_LT_F:  return "l < r";
+        case OP_GT_I:  case OP_GT_F:  return "l > r";
+        case OP_LE_I:  case OP_LE_F:  return "l <= r";
+        default:                      return "l >= r";
+    }
+}
+
+static const char *comparison_operator(uint8_t opcode) {
+    switch (opcode) {
+        case OP_EQ_I: case OP_EQ_F:   return "==";
+        case OP_NEQ_I: case OP_NEQ_F: return "!=";
+        case OP_LT_I: case OP_LT_F:   return "<";
+        case OP_GT_I: case OP_GT_F:   return ">";
+        case OP_LE_I: case OP_LE_F:   return "<=";
+        default:                      return ">=";
+    }
+}
+
+static const char *float_expression(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD_F: return "l + r";
+        case OP_SUB_F: return "l - r";
+        case OP_MUL_F: return "l * r";
+        case OP_DIV_F: return "l / r";
+        case OP_MOD_F: return "float_mod(l, r)";
+        default:       return int_expression(opcode);
+    }
+}
+
+// Untyped opcodes, the same expressions vm_run passes to BINARY_OP
+static const char *generic_operation(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD: return "BINARY_OP(l + r, l + r)";
+        case OP_SUB: return "BINARY_OP(l - r, l - r)";
+        case OP_MUL: return "BINARY_OP(WRAPPING_MUL(l, r), l * r)";
+        case OP_DIV: return "DIVISION_OP(l / r, int_div(l, r))";
+        case OP_MOD: return "DIVISION_OP(float_mod(l, r), int_mod(l, r))";
+        case OP_EQ:  return "BINARY_OP(l == r, l == r)";
+        case OP_NEQ: return "BINARY_OP(l != r, l != r)";
+        case OP_LT:  return "BINARY_OP(l < r, l < r)";
+        case OP_GT:  return "BINARY_OP(l > r, l > r)";
+        case OP_LE:  return "BINARY_OP(l <= r, l <= r)";
+        default:     return "BINARY_OP(l >= r, l >= r)";
+    }
+}
+
+static void emit_instruction(FILE *out, const VM *vm, uint32_t offset, Instruction instr) {
+    uint32_t arg = instr.arg;
+    uint8_t op = instr.opcode;
+    uint32_t halt = vm->program_size;
+
+    switch (op) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+            fprintf(out, "%s;", generic_operation(op));
+            break;
+
+        case OP_ADD_I: case OP_SUB_I: case OP_MUL_I: case OP_DIV_I: case OP_MOD_I:
+            fprintf(out, "INT_OP(INT_TYPE, %s);", int_expression(op));
+            break;
+        case OP_EQ_I: case OP_NEQ_I: case OP_LT_I: case OP_GT_I: case OP_LE_I: case OP_GE_I:
+            fprintf(out, "INT_OP(BOOL_TYPE, %s);", int_expression(op));
+            break;
+        case OP_ADD_F: case OP_SUB_F: case OP_MUL_F: case OP_DIV_F: case OP_MOD_F:
+            fprintf(out, "FLOAT_OP(%s);", float_expression(op));
+            break;
+        case OP_EQ_F: case OP_NEQ_F: case OP_LT_F: case OP_GT_F: case OP_LE_F: case OP_GE_F:
+            fprintf(out, "FLOAT_CMP_OP(%s);", float_expression(op));
+            break;
+
+        case OP_AND: fprintf(out, "AND_OP();"); break;
+        case OP_OR:  fprintf(out, "OR_OP();"); break;
+        case OP_NOT: fprintf(out, "NOT_OP();"); break;
+
+        case OP_STORE:      fprintf(out, "PUSH(FROM_INT(%" PRId32 "));", (int32_t) arg); break;
+        case OP_STORE_BYTE: fprintf(out, "PUSH(BOX(BOOL_TYPE, %" PRIu32 "u));", arg); break;
+        case OP_STORE_CHAR: fprintf(out, "PUSH(BOX(CHAR_TYPE, %" PRIu32 "u));", arg); break;
+        case OP_STORE_FLOAT:
+            fprintf(out, "PUSH(");
+            emit_float(out, float_from_bits(arg));
+            fprintf(out, ");");
+            break;
+
+        // Float constants are inlined, arrays are heap blocks made by the loader
+        case OP_LOAD_CONST:
+            if (IS_FLOAT(vm->constants[arg])) fprintf(out, "PUSH(0x%016" PRIX64 "ULL);", vm->constants[arg]);
+            else fprintf(out, "PUSH(vm->constants[%" PRIu32 "]);", arg);
+            break;
+
+        case OP_LOAD:           fprintf(out, "PUSH(vm->globals.slots[%" PRIu32 "]);", arg); break;
+        case OP_STORE_MEM:      fprintf(out, "STORE_MEM_OP(%" PRIu32 ");", arg); break;
+        case OP_LOAD_LOCAL:     fprintf(out, "PUSH(vm->locals.frame[%" PRIu32 "]);", arg); break;
+        case OP_STORE_LOCAL:    fprintf(out, "STORE_LOCAL_OP(%" PRIu32 ");", arg); break;
+        case OP_ENTER:          fprintf(out, "locals_enter(&vm->locals, %" PRIu32 "u);", arg); break;
+        case OP_INC_MEM:        fprintf(out, "INC_MEM_OP(%" PRIu32 ");", arg); break;
+        case OP_LOAD_LOAD_ADD:  fprintf(out, "LOAD_LOAD_ADD_OP(%" PRIu32 "u);", arg); break;
+        case OP_LOAD_CONST_ADD: fprintf(out, "LOAD_CONST_ADD_OP(%" PRId32 ");", (int32_t) arg); break;
+        case OP_CONCAT:         fprintf(out, "CONCAT_OP();"); break;
+        case OP_LIST_ACCESS:    fprintf(out, "LIST_ACCESS_OP(%" PRIu32 "u);", arg); break;
+        case OP_LIST_SET:       fprintf(out, "LIST_SET_OP(%" PRIu32 "u);", arg); break;
+
+        case OP_BUILD_LIST: case OP_CAST:
+            fprintf(out, "SERVICE(%s(vm, (Instruction) { 0x%02X, %" PRIu32 "u }));",
+                op == OP_BUILD_LIST ? "handle_build_list" : "handle_cast", op, arg);
+            break;
+        case OP_SYSCALL:
+            fprintf(out, "SERVICE(syscall(vm, %" PRId32 "));", (int32_t) arg);
+            break;
+
+        case OP_JUMP:
+            fprintf(out, "GC_SAFE_POINT(); goto L%" PRIu32 ";", arg);
+            break;
+        case OP_TAIL_CALL:
+            fprintf(out, "vm->locals.top = locals_base(&vm->locals); GC_SAFE_POINT(); goto L%" PRIu32 ";", arg);
+            break;
+        case OP_JUMP_IF:
+            fprintf(out, "NEED(1); { int condition = AS_BOOL(tos); DROP(1); GC_SAFE_POINT(); "
+                "if (condition) goto L%" PRIu32 "; }", arg);
+            break;
+        case OP_CMP_JUMP_IF_FALSE: {
+            uint8_t compare = arg >> 24;
+            const char *as = compare >= OP_EQ_F ? "AS_FLOAT" : "AS_INT";
+            fprintf(out, "NEED(2); { Item right = tos, left = sp[-1]; DROP(2); GC_SAFE_POINT(); "
+                "if (!(%s(left) %s %s(right))) goto L%" PRIu32 "; }",
+                as, comparison_operator(compare), as, arg & 0xFFFFFF);
+            break;
+        }
+
+        case OP_CALL:
+            if (arg == (uint32_t) -1) fprintf(out, "NEED(1); target = ITEM_BITS(tos); DROP(1);");
+            else fprintf(out, "target = ITEM_BITS(vm->globals.slots[%" PRIu32 "]);", arg);
+            fprintf(out, "\n    if (target > %" PRIu32 "u) handle_error(INVALID_BYTECODE);"
+                "\n    frame_push(vm, vm->bytecode + %" PRIu32 ");"
+                "\n    GC_SAFE_POINT(); goto dispatch;", halt, offset + 1);
+            break;
+        case OP_CALL_DIRECT:
+            fprintf(out, "frame_push(vm, vm->bytecode + %" PRIu32 ");"
+                "\n    GC_SAFE_POINT(); goto L%" PRIu32 ";", offset + 1, arg);
+            break;
+        case OP_RETURN:
+            fprintf(out, "if (vm->frame_pointer == 0) goto L%" PRIu32 ";"
+                "\n    target = frame_pop(vm) - vm->bytecode; goto dispatch;", halt);
+            break;
+
+        case OP_HALT:
+            fprintf(out, "goto L%" PRIu32 ";", halt);
+            break;
+
+        default: // GLOBALS, DEFINE_TYPE, NEW, OBJCALL
+            fprintf(out, ";");
+            break;
+    }
+}
+
+void emit_c(const VM *vm, const char *program, const char *output) {
+    uint32_t size = vm->program_size;
+    const Instruction *bytecode = vm->bytecode;
+
+    // entries: reachable through dispatch, labels: every goto target
+    uint8_t *entries = calloc(size + 1, 1);
+    uint8_t *labels = calloc(size + 1, 1);
+    if (!entries || !labels) handle_error(UNDEFINED_ERROR);
+
+    for (uint32_t i = 0; i < size; i++) {
+        Instruction instr = bytecode[i];
+        switch (instr.opcode) {
+            case OP_STORE:
+                if (instr.arg <= size) entries[instr.arg] = 1;
+                break;
+            case OP_CALL:
+                entries[i + 1] = 1;
+                break;
+            case OP_CALL_DIRECT:
+                entries[i + 1] = 1;
+                labels[instr.arg] = 1;
+                break;
+            case OP_RETURN: case OP_HALT:
+                labels[size] = 1;
+                break;
+            case OP_JUMP: case OP_JUMP_IF: case OP_TAIL_CALL:
+                labels[instr.arg] = 1;
+                break;
+            case OP_CMP_JUMP_IF_FALSE:
+                labels[instr.arg & 0xFFFFFF] = 1;
+                break;
+        }
+    }
+
+    size_t bytes;
+    uint8_t *image = read_program(program, &bytes);
+
+    FILE *out = fopen(output, "w");
+    if (!out) handle_error(FILE_PERMISSION_ERROR);
+
+    fprintf(out, "// Translated from %s by `vml --emit-c`, %" PRIu32 " instructions.\n", program, size);
+    fprintf(out, "// Build it against the VM runtime: make aot PROGRAM=%s\n", program);
+    fprintf(out, "#include \"includes/interpreter.h\"\n\n");
+    emit_image(out, image, bytes);
+    free(image);
+
+    fprintf(out, "static void run(VM *vm) {\n");
+    fprintf(out, "    static void *const entries[%" PRIu32 "] = {", size + 1);
+    for (uint32_t i = 0; i <= size; i++)
+        if (entries[i]) fprintf(out, " [%" PRIu32 "] = &&L%" PRIu32 ",", i, i);
+    fprintf(out, " };\n");
+    fprintf(out,
+        "    Instruction *pc = vm->pc;\n"
+        "    instr_pc_log = &vm->opcode;\n"
+        "    Item *sp = vm->stack.data + vm->stack.top;\n"
+        "    Item tos = *sp;\n"
+        "    Item *const stack_limit = vm->stack.data + STACK_SIZE - 1;\n"
+        "    uint32_t target = pc - vm->bytecode;\n"
+        "    if (target) goto dispatch;\n\n");
+
+    for (uint32_t i = 0; i < size; i++) {
+        Instruction instr = bytecode[i];
+        if (labels[i] || entries[i]) fprintf(out, "L%" PRIu32 ":\n", i);
+        fprintf(out, "    vm->opcode = 0x%02X; // %s %" PRIu32 "\n    ", instr.opcode, opcode_name(instr.opcode), instr.arg);
+        emit_instruction(out, vm, i, instr);
+        fprintf(out, "\n");
+    }
+
+    // Past the last instruction: HALT. Call and return destinations without
+    // an entry continue in the interpreter.
+    if (labels[size] || entries[size]) fprintf(out, "L%" PRIu32 ":\n", size);
+    fprintf(out,
+        "    SAVE_STATE();\n"
+        "    return;\n\n"
+        "dispatch:\n"
+        "    if (target <= %" PRIu32 "u && entries[target]) goto *entries[target];\n"
+        "    pc = vm->bytecode + target;\n"
+        "    SAVE_STATE();\n"
+        "    vm_run(vm);\n"
+        "}\n\n", size);
+
+    fprintf(out,
+        "int main(int argc, char *argv[]) {\n"
+        "    return vm_main(argc, argv, program_image, sizeof(program_image), run);\n"
+        "}\n");
+
+    if (fclose(out) != 0) handle_error(FILE_PERMISSION_ERROR);
+    free(entries);
+    free(labels);
+}
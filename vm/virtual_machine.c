@@ -1,49 +1,93 @@
 #include "virtual_machine.h"
 #include "includes/opcode_handlers.h"
+#include "includes/opcodes.h"
+#include "includes/gc.h"
+#include "includes/loader.h"
+#include "includes/jit.h"
+#include "includes/kernels.h"
+#include "includes/parallel.h"
+#include "includes/interpreter.h"
+#include "includes/translate.h"
+#include <inttypes.h>
 
-void vm_init(VM *vm, const char *filename) {
+void vm_init(VM *vm, const VMOptions *options) {
     stack_init(&vm->stack);
-    memory_init(&vm->memory);
     heap_init(&vm->heap);
+    gc_configure(&vm->heap, options->gc_threshold, options->gc_growth);
+    output_init(&vm->output, stdout, options->output_buffer, options->unbuffered);
 
-    
-    FILE *file = fopen(filename, "rb");
-    if (!file) handle_error(FILE_NOT_FOUND);
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
     string_format = 0;
     vm->frame_pointer = 0;
-    vm->program_size = size/5;
-    vm->bytecode = malloc(sizeof(Instruction) * (vm->program_size + 1));
+    vm->max_depth = options->max_depth;
+    vm->frame_capacity = (INITIAL_FRAMES < vm->max_depth) ? INITIAL_FRAMES : vm->max_depth;
+    vm->frames = malloc(sizeof(Frame) * vm->frame_capacity);
+
+    if (options->image) {
+        load_image(vm, options->image, options->image_size);
+    } else {
+        LoadStats stats;
+        load_program(vm, options->filename, &stats);
+        if (options->load_stats) print_load_stats(&stats, stderr);
+    }
     vm->pc = vm->bytecode;
+    kernels_select(options->kernels);
+    vm->threads = options->threads;
+    vm->pool = NULL;
 
-    for (int i = 0; i < vm->program_size; i++) {
-        fread(&vm->bytecode[i].opcode, sizeof(uint8_t), 1, file);
-        fread(&vm->bytecode[i].arg, sizeof(uint32_t), 1, file);
+    vm->profile = NULL;
+    if (options->profile) {
+        vm->profile = malloc(sizeof(Profile));
+        if (!vm->profile) handle_error(UNDEFINED_ERROR);
+        profile_init(vm->profile, vm->program_size + 1, options->profile_output);
     }
 
-    fclose(file);
+    // Compiled code doesn't count instructions, profiles are interpreter-only
+    vm->jit = NULL;
+#ifdef JIT_SUPPORTED
+    if (options->jit && !options->profile) vm->jit = jit_create(vm, options->jit_threshold);
+#endif
 }
 
 void vm_destroy(VM *vm) {
     if (!vm) return;
 
+    pool_destroy(vm->pool);
+    vm->pool = NULL;
+
     if (vm->bytecode) {
         free(vm->bytecode);
         vm->bytecode = NULL;
     }
 
-    memory_destroy(&vm->memory);
+    globals_destroy(&vm->globals);
+    locals_destroy(&vm->locals);
     heap_destroy(&vm->heap);
+    output_destroy(&vm->output);
+
+    free(vm->constants);
+    vm->constants = NULL;
+    vm->constant_count = 0;
+
+    if (vm->profile) {
+        profile_destroy(vm->profile);
+        free(vm->profile);
+        vm->profile = NULL;
+    }
+
+#ifdef JIT_SUPPORTED
+    jit_destroy(vm->jit);
+    vm->jit = NULL;
+#endif
+
+    if (vm->frames) {
+        free(vm->frames);
+        vm->frames = NULL;
+    }
 
     vm->program_size = 0;
     vm->frame_pointer = 0;
+    vm->frame_capacity = 0;
     vm->pc = NULL;
-
-    for (int i = 0; i < RECURSION_LIMIT; i++)
-        vm->return_address[i] = NULL;
 }
 
 OpcodeHandler opcode_handlers[] = {
@@ -63,88 +107,548 @@ OpcodeHandler opcode_handlers[] = {
     [0x1C] = handle_define_type,
     [0x1D] = handle_new,
     [0x1E] = handle_cast,
+    [0x1F] = handle_globals,
+    [OP_ADD_I ... OP_GE_F] = handle_typed_alu,
+    [OP_CONCAT] = handle_concat,
+    [OP_LOAD_CONST] = handle_load_const,
+    [OP_CALL_DIRECT] = handle_call_direct,
+    [OP_TAIL_CALL] = handle_tail_call,
+    [OP_LOAD_LOCAL] = handle_load_local,
+    [OP_STORE_LOCAL] = handle_store_local,
+    [OP_ENTER] = handle_enter,
+    [OP_INC_MEM] = handle_inc_mem,
+    [OP_LOAD_LOAD_ADD] = handle_load_load_add,
+    [OP_CMP_JUMP_IF_FALSE] = handle_cmp_jump_if_false,
+    [OP_LOAD_CONST_ADD] = handle_load_const_add,
     [0xFE] = handle_objcall,
     [0xFF] = handle_syscall,
 };
 
-void string_format_proc(VM* vm) {
-    Item right, left; pop(&vm->stack);
-    right = pop(&vm->stack); left = pop(&vm->stack);
-
-    string_format = 0;
-    
-    if (left.type == ARRAY_TYPE) {
-        if (right.type == ARRAY_TYPE) {
-            uint32_t buffer;
-            for (int i = 0; i < vm->heap.blocks[right.value].size; i++) {
-                heap_read(&vm->heap, right.value, &buffer, i, 1);
-                heap_write(&vm->heap, left.value, buffer, vm->heap.blocks[left.value].size + 1, 1);
-            }
-            
-            push(&vm->stack, left);
-        } else {
-            char str[32];
-            if (right.type == FLOAT_TYPE) {
-                sprintf(str, "%g", extract_float(right));
-            } else {
-                sprintf(str, "%d", right.value);
-            }
-            
-            vm->heap.table_type[left.value] = CHAR_TYPE;
-            for (int i = 0; i < strlen(str); i++)
-                heap_write(&vm->heap, left.value, str[i], vm->heap.blocks[left.value].size + i, 1);
-            
-            push(&vm->stack, left);
-        }
-    } else {
-        char str[32];
-        if (right.type == FLOAT_TYPE) {
-            sprintf(str, "%g", extract_float(right));
-        } else {
-            sprintf(str, "%d", right.value);
-        }
+// A number operand of `+` becomes a fresh CHAR block holding its text
+static size_t format_number(Heap *heap, Item item) {
+    char str[32];
+    size_t length = IS_FLOAT(item) ? format_float(str, AS_FLOAT(item)) : format_int(str, AS_INT(item));
 
-        size_t address = heap_add_block(&vm->heap, CHAR_TYPE);
-        for (int i = 0; i < strlen(str); i++)
-            heap_write(&vm->heap, left.value, str[i], vm->heap.blocks[left.value].size + i, 1);
+    size_t address = heap_add_block(heap, CHAR_TYPE);
+    heap_fill(heap, address, 0, str, length);
+    return address;
+}
 
-        uint32_t buffer;
-        for (int i = 0; i < vm->heap.blocks[right.value].size; i++) {
-            heap_read(&vm->heap, right.value, &buffer, i, 1);
-            heap_write(&vm->heap, address, buffer, i, 1);
-        }
+// `+` with an array operand. Neither operand is modified, the result is a
+// new block built by heap_concat, so `s = s + x` in a loop is amortized O(1).
+void string_format_proc(VM* vm, Item left, Item right) {
+    Heap *heap = &vm->heap;
+    DataType type = CHAR_TYPE;
 
-        push(&vm->stack, (Item) {
-            ARRAY_TYPE,
-            address
-        });
+    if (HAS_TAG(left, ARRAY_TYPE) && HAS_TAG(right, ARRAY_TYPE)) {
+        // An empty literal ("" or []) takes the element type of what is appended
+        type = heap->blocks[ITEM_BITS(left)].type;
+        if (type == UNASSIGNED_TYPE) type = heap->blocks[ITEM_BITS(right)].type;
     }
+
+    size_t left_address = HAS_TAG(left, ARRAY_TYPE) ? ITEM_BITS(left) : format_number(heap, left);
+    size_t right_address = HAS_TAG(right, ARRAY_TYPE) ? ITEM_BITS(right) : format_number(heap, right);
+
+    push(&vm->stack, BOX(ARRAY_TYPE, heap_concat(heap, left_address, right_address, type)));
 }
 
+#ifdef VM_LEGACY_DISPATCH
+
 void vm_run(VM *vm) {
+    instr_pc_log = &vm->opcode;
     while (vm->pc < vm->bytecode + vm->program_size) {
+        if (vm->profile) profile_step(vm->profile, vm->pc - vm->bytecode, vm->pc->opcode);
         Instruction instr = *vm->pc++;
-        instr_pc_log = instr.opcode;
+        vm->opcode = instr.opcode;
 
         if (instr.opcode < 0x0F) {
             alu(&vm->stack, instr.opcode);
-            if (string_format) string_format_proc(vm);
+            if (string_format) {
+                Item right, left; pop(&vm->stack);
+                right = pop(&vm->stack); left = pop(&vm->stack);
+                string_format = 0;
+                string_format_proc(vm, left, right);
+            }
             continue;
         }
         
         OpcodeHandler handler = opcode_handlers[instr.opcode];
         if (!handler) handle_error(UNDEFINED_ERROR);
         handler(vm, instr);
+
+        if (vm->heap.gc.pending) gc_collect(vm);
     }
 }
 
-int main(int argc, char* argv[]) {
-    const char* filename = (argc < 2) ? "output.o" : argv[1];
+#else
+
+// Threaded interpreter core: every opcode owns its body. pc, the stack
+// pointer and the top of the stack live in locals and are only written back
+// around calls into the rest of the VM (SAVE_STATE / LOAD_STATE), see
+// includes/interpreter.h.
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+// Calls and taken backward branches count towards compiling the code at pc,
+// which then runs until it has to come back to the interpreter
+#ifdef JIT_SUPPORTED
+#define JIT_ENTER(end) if (vm->jit) { \
+        SAVE_STATE(); \
+        jit_enter(vm, pc - vm->bytecode, (end)); \
+        LOAD_STATE(); \
+    }
+#define JIT_LOOP(branch) if (pc <= (branch)) JIT_ENTER((branch) - vm->bytecode)
+#else
+#define JIT_ENTER(end)
+#define JIT_LOOP(branch) (void) (branch)
+#endif
+
+#define CALL_TO(target) do { \
+        frame_push(vm, pc); \
+        pc = vm->bytecode + (target); \
+        GC_SAFE_POINT(); \
+        JIT_ENTER((target) + JIT_MAX_REGION - 1); \
+    } while (0)
+
+// With --profile every entry of the dispatch table leads to TARGET_PROFILE,
+// which counts the instruction and continues through opcode_targets. The
+// opcode bodies have no profiling code, so it costs nothing when off.
+#ifdef VM_COMPUTED_GOTO
+#define CASE(op) TARGET_##op:
+#define NEXT() do { \
+        instr = *pc++; \
+        vm->opcode = instr.opcode; \
+        goto *dispatch_table[instr.opcode]; \
+    } while (0)
+#else
+#define CASE(op) case op:
+#define NEXT() continue
+#endif
+
+void vm_run(VM *vm) {
+    Instruction *pc = vm->pc;
+    instr_pc_log = &vm->opcode;
+    Item *sp = vm->stack.data + vm->stack.top;
+    Item tos = *sp;
+    Item *const stack_limit = vm->stack.data + STACK_SIZE - 1;
+    Instruction instr;
+
+#ifdef VM_COMPUTED_GOTO
+    // Every entry defaults to TARGET_UNDEFINED and the opcodes override it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void *const opcode_targets[256] = {
+        [0 ... 255]      = &&TARGET_UNDEFINED,
+        [OP_HALT]        = &&TARGET_OP_HALT,
+        [OP_ADD]         = &&TARGET_OP_ADD,
+        [OP_SUB]         = &&TARGET_OP_SUB,
+        [OP_MUL]         = &&TARGET_OP_MUL,
+        [OP_DIV]         = &&TARGET_OP_DIV,
+        [OP_MOD]         = &&TARGET_OP_MOD,
+        [OP_AND]         = &&TARGET_OP_AND,
+        [OP_OR]          = &&TARGET_OP_OR,
+        [OP_NOT]         = &&TARGET_OP_NOT,
+        [OP_EQ]          = &&TARGET_OP_EQ,
+        [OP_NEQ]         = &&TARGET_OP_NEQ,
+        [OP_LT]          = &&TARGET_OP_LT,
+        [OP_GT]          = &&TARGET_OP_GT,
+        [OP_LE]          = &&TARGET_OP_LE,
+        [OP_GE]          = &&TARGET_OP_GE,
+        [OP_STORE]       = &&TARGET_OP_STORE,
+        [OP_STORE_BYTE]  = &&TARGET_OP_STORE_BYTE,
+        [OP_STORE_FLOAT] = &&TARGET_OP_STORE_FLOAT,
+        [OP_STORE_CHAR]  = &&TARGET_OP_STORE_CHAR,
+        [OP_STORE_MEM]   = &&TARGET_OP_STORE_MEM,
+        [OP_LOAD]        = &&TARGET_OP_LOAD,
+        [OP_JUMP]        = &&TARGET_OP_JUMP,
+        [OP_JUMP_IF]     = &&TARGET_OP_JUMP_IF,
+        [OP_CALL]        = &&TARGET_OP_CALL,
+        [OP_RETURN]      = &&TARGET_OP_RETURN,
+        [OP_BUILD_LIST]  = &&TARGET_OP_BUILD_LIST,
+        [OP_LIST_ACCESS] = &&TARGET_OP_LIST_ACCESS,
+        [OP_LIST_SET]    = &&TARGET_OP_LIST_SET,
+        [OP_DEFINE_TYPE] = &&TARGET_OP_DEFINE_TYPE,
+        [OP_NEW]         = &&TARGET_OP_NEW,
+        [OP_CAST]        = &&TARGET_OP_CAST,
+        [OP_GLOBALS]     = &&TARGET_OP_GLOBALS,
+        [OP_ADD_I]       = &&TARGET_OP_ADD_I,
+        [OP_SUB_I]       = &&TARGET_OP_SUB_I,
+        [OP_MUL_I]       = &&TARGET_OP_MUL_I,
+        [OP_DIV_I]       = &&TARGET_OP_DIV_I,
+        [OP_MOD_I]       = &&TARGET_OP_MOD_I,
+        [OP_ADD_F]       = &&TARGET_OP_ADD_F,
+        [OP_SUB_F]       = &&TARGET_OP_SUB_F,
+        [OP_MUL_F]       = &&TARGET_OP_MUL_F,
+        [OP_DIV_F]       = &&TARGET_OP_DIV_F,
+        [OP_MOD_F]       = &&TARGET_OP_MOD_F,
+        [OP_EQ_I]        = &&TARGET_OP_EQ_I,
+        [OP_NEQ_I]       = &&TARGET_OP_NEQ_I,
+        [OP_LT_I]        = &&TARGET_OP_LT_I,
+        [OP_GT_I]        = &&TARGET_OP_GT_I,
+        [OP_LE_I]        = &&TARGET_OP_LE_I,
+        [OP_GE_I]        = &&TARGET_OP_GE_I,
+        [OP_EQ_F]        = &&TARGET_OP_EQ_F,
+        [OP_NEQ_F]       = &&TARGET_OP_NEQ_F,
+        [OP_LT_F]        = &&TARGET_OP_LT_F,
+        [OP_GT_F]        = &&TARGET_OP_GT_F,
+        [OP_LE_F]        = &&TARGET_OP_LE_F,
+        [OP_GE_F]        = &&TARGET_OP_GE_F,
+        [OP_CONCAT]      = &&TARGET_OP_CONCAT,
+        [OP_LOAD_CONST]  = &&TARGET_OP_LOAD_CONST,
+        [OP_CALL_DIRECT] = &&TARGET_OP_CALL_DIRECT,
+        [OP_TAIL_CALL]   = &&TARGET_OP_TAIL_CALL,
+        [OP_LOAD_LOCAL]  = &&TARGET_OP_LOAD_LOCAL,
+        [OP_STORE_LOCAL] = &&TARGET_OP_STORE_LOCAL,
+        [OP_ENTER]       = &&TARGET_OP_ENTER,
+        [OP_INC_MEM]     = &&TARGET_OP_INC_MEM,
+        [OP_LOAD_LOAD_ADD] = &&TARGET_OP_LOAD_LOAD_ADD,
+        [OP_CMP_JUMP_IF_FALSE] = &&TARGET_OP_CMP_JUMP_IF_FALSE,
+        [OP_LOAD_CONST_ADD] = &&TARGET_OP_LOAD_CONST_ADD,
+        [OP_OBJCALL]     = &&TARGET_OP_OBJCALL,
+        [OP_SYSCALL]     = &&TARGET_OP_SYSCALL,
+    };
+#pragma GCC diagnostic pop
+    static void *const profile_targets[256] = { [0 ... 255] = &&TARGET_PROFILE };
+    void *const *dispatch_table = vm->profile ? profile_targets : opcode_targets;
+
+    NEXT();
+
+    TARGET_PROFILE:
+        profile_step(vm->profile, pc - 1 - vm->bytecode, instr.opcode);
+        goto *opcode_targets[instr.opcode];
+#else
+    for (;;) {
+        instr = *pc++;
+        vm->opcode = instr.opcode;
+        if (vm->profile) profile_step(vm->profile, pc - 1 - vm->bytecode, instr.opcode);
+
+        switch (instr.opcode) {
+#endif
+
+    CASE(OP_ADD) BINARY_OP(l + r, l + r); NEXT();
+    CASE(OP_SUB) BINARY_OP(l - r, l - r); NEXT();
+    CASE(OP_MUL) BINARY_OP(WRAPPING_MUL(l, r), l * r); NEXT();
+    CASE(OP_DIV) DIVISION_OP(l / r, int_div(l, r)); NEXT();
+    CASE(OP_MOD) DIVISION_OP(float_mod(l, r), int_mod(l, r)); NEXT();
+
+    CASE(OP_EQ)  BINARY_OP(l == r, l == r); NEXT();
+    CASE(OP_NEQ) BINARY_OP(l != r, l != r); NEXT();
+    CASE(OP_LT)  BINARY_OP(l < r, l < r); NEXT();
+    CASE(OP_GT)  BINARY_OP(l > r, l > r); NEXT();
+    CASE(OP_LE)  BINARY_OP(l <= r, l <= r); NEXT();
+    CASE(OP_GE)  BINARY_OP(l >= r, l >= r); NEXT();
+
+    CASE(OP_ADD_I) INT_OP(INT_TYPE, l + r); NEXT();
+    CASE(OP_SUB_I) INT_OP(INT_TYPE, l - r); NEXT();
+    CASE(OP_MUL_I) INT_OP(INT_TYPE, WRAPPING_MUL(l, r)); NEXT();
+    CASE(OP_DIV_I) INT_OP(INT_TYPE, int_div(l, r)); NEXT();
+    CASE(OP_MOD_I) INT_OP(INT_TYPE, int_mod(l, r)); NEXT();
+    CASE(OP_EQ_I)  INT_OP(BOOL_TYPE, l == r); NEXT();
+    CASE(OP_NEQ_I) INT_OP(BOOL_TYPE, l != r); NEXT();
+    CASE(OP_LT_I)  INT_OP(BOOL_TYPE, l < r); NEXT();
+    CASE(OP_GT_I)  INT_OP(BOOL_TYPE, l > r); NEXT();
+    CASE(OP_LE_I)  INT_OP(BOOL_TYPE, l <= r); NEXT();
+    CASE(OP_GE_I)  INT_OP(BOOL_TYPE, l >= r); NEXT();
+
+    CASE(OP_ADD_F) FLOAT_OP(l + r); NEXT();
+    CASE(OP_SUB_F) FLOAT_OP(l - r); NEXT();
+    CASE(OP_MUL_F) FLOAT_OP(l * r); NEXT();
+    CASE(OP_DIV_F) FLOAT_OP(l / r); NEXT();
+    CASE(OP_MOD_F) FLOAT_OP(float_mod(l, r)); NEXT();
+    CASE(OP_EQ_F)  FLOAT_CMP_OP(l == r); NEXT();
+    CASE(OP_NEQ_F) FLOAT_CMP_OP(l != r); NEXT();
+    CASE(OP_LT_F)  FLOAT_CMP_OP(l < r); NEXT();
+    CASE(OP_GT_F)  FLOAT_CMP_OP(l > r); NEXT();
+    CASE(OP_LE_F)  FLOAT_CMP_OP(l <= r); NEXT();
+    CASE(OP_GE_F)  FLOAT_CMP_OP(l >= r); NEXT();
+
+    CASE(OP_CONCAT)        CONCAT_OP(); NEXT();
+    CASE(OP_INC_MEM)       INC_MEM_OP(instr.arg); NEXT();
+    CASE(OP_LOAD_LOAD_ADD) LOAD_LOAD_ADD_OP(instr.arg); NEXT();
+
+    CASE(OP_CMP_JUMP_IF_FALSE) {
+        NEED(2);
+        Item right = tos, left = sp[-1];
+        int64_t l = AS_INT(left), r = AS_INT(right);
+        double lf = AS_FLOAT(left), rf = AS_FLOAT(right);
+        int condition;
+        DROP(2);
+
+        switch (instr.arg >> 24) {
+            case OP_EQ_I:  condition = l == r; break;
+            case OP_NEQ_I: condition = l != r; break;
+            case OP_LT_I:  condition = l < r; break;
+            case OP_GT_I:  condition = l > r; break;
+            case OP_LE_I:  condition = l <= r; break;
+            case OP_GE_I:  condition = l >= r; break;
+            case OP_EQ_F:  condition = lf == rf; break;
+            case OP_NEQ_F: condition = lf != rf; break;
+            case OP_LT_F:  condition = lf < rf; break;
+            case OP_GT_F:  condition = lf > rf; break;
+            case OP_LE_F:  condition = lf <= rf; break;
+            case OP_GE_F:  condition = lf >= rf; break;
+            default: handle_error(UNDEFINED_ERROR);
+        }
+
+        Instruction *branch = pc - 1;
+        if (!condition) pc = vm->bytecode + (instr.arg & 0xFFFFFF);
+        GC_SAFE_POINT();
+        JIT_LOOP(branch);
+        NEXT();
+    }
+
+    CASE(OP_LOAD_CONST_ADD) LOAD_CONST_ADD_OP((int32_t) instr.arg); NEXT();
+
+    CASE(OP_AND) AND_OP(); NEXT();
+    CASE(OP_OR)  OR_OP(); NEXT();
+    CASE(OP_NOT) NOT_OP(); NEXT();
+
+    CASE(OP_STORE)       PUSH(FROM_INT((int32_t) instr.arg)); NEXT();
+    CASE(OP_STORE_BYTE)  PUSH(BOX(BOOL_TYPE, instr.arg)); NEXT();
+    CASE(OP_STORE_FLOAT) PUSH(FROM_FLOAT(float_from_bits(instr.arg))); NEXT();
+    CASE(OP_STORE_CHAR)  PUSH(BOX(CHAR_TYPE, instr.arg)); NEXT();
+
+    CASE(OP_STORE_MEM)   STORE_MEM_OP(instr.arg); NEXT();
+    CASE(OP_LOAD)        PUSH(vm->globals.slots[instr.arg]); NEXT();
+    CASE(OP_LOAD_CONST)  PUSH(vm->constants[instr.arg]); NEXT();
+    CASE(OP_LOAD_LOCAL)  PUSH(vm->locals.frame[instr.arg]); NEXT();
+    CASE(OP_STORE_LOCAL) STORE_LOCAL_OP(instr.arg); NEXT();
+
+    // Out of line: inlined here, the window bookkeeping costs the other
+    // opcodes their registers
+    CASE(OP_ENTER)       handle_enter(vm, instr); NEXT();
+
+    CASE(OP_JUMP) {
+        Instruction *branch = pc - 1;
+        pc = vm->bytecode + instr.arg;
+        GC_SAFE_POINT();
+        JIT_LOOP(branch);
+        NEXT();
+    }
+
+    CASE(OP_JUMP_IF) {
+        NEED(1);
+        int condition = AS_BOOL(tos);
+        Instruction *branch = pc - 1;
+        DROP(1);
+        if (condition) pc = vm->bytecode + instr.arg;
+        GC_SAFE_POINT();
+        JIT_LOOP(branch);
+        NEXT();
+    }
+
+    CASE(OP_CALL) {
+        uint32_t dir;
+        if (instr.arg == (uint32_t) -1) {
+            NEED(1);
+            dir = ITEM_BITS(tos);
+            DROP(1);
+        } else {
+            dir = ITEM_BITS(vm->globals.slots[instr.arg]);
+        }
+
+        if (dir > (uint32_t) vm->program_size) handle_error(INVALID_BYTECODE);
+        CALL_TO(dir);
+        NEXT();
+    }
+
+    // The loader has checked the target
+    CASE(OP_CALL_DIRECT) CALL_TO(instr.arg); NEXT();
+
+    // `return f(...)`: no frame is pushed, f returns to our caller and its
+    // ENTER reopens our window
+    CASE(OP_TAIL_CALL)
+        vm->locals.top = locals_base(&vm->locals);
+        pc = vm->bytecode + instr.arg;
+        GC_SAFE_POINT();
+        JIT_ENTER(instr.arg + JIT_MAX_REGION - 1);
+        NEXT();
+
+    CASE(OP_RETURN)
+        pc = (vm->frame_pointer == 0) ?
+            vm->bytecode + vm->program_size : frame_pop(vm);
+        NEXT();
+
+    CASE(OP_LIST_ACCESS) LIST_ACCESS_OP(instr.arg); NEXT();
+    CASE(OP_LIST_SET)    LIST_SET_OP(instr.arg); NEXT();
+
+    CASE(OP_BUILD_LIST)  SERVICE(handle_build_list(vm, instr)); NEXT();
+    CASE(OP_CAST)        SERVICE(handle_cast(vm, instr)); NEXT();
+    CASE(OP_SYSCALL)     SERVICE(syscall(vm, instr.arg)); NEXT();
+
+    CASE(OP_GLOBALS)
+    CASE(OP_DEFINE_TYPE)
+    CASE(OP_NEW)
+    CASE(OP_OBJCALL)
+        NEXT();
+
+    CASE(OP_HALT)
+        SAVE_STATE();
+        return;
+
+#ifdef VM_COMPUTED_GOTO
+    TARGET_UNDEFINED:
+        handle_error(UNDEFINED_ERROR);
+#else
+        default:
+            handle_error(UNDEFINED_ERROR);
+        }
+    }
+#endif
+}
+
+#endif
+
+// Runs the function at `address` to its RETURN from inside a syscall, for
+// built-ins taking a function value. Its frame returns to the HALT sentinel,
+// which hands control back here. The arguments are on the stack, the result
+// is left there.
+void vm_call(VM *vm, uint32_t address) {
+    if (address >= (uint32_t) vm->program_size) handle_error(INVALID_BYTECODE);
+    Instruction *resume = vm->pc;
+
+    // A callee without jumps or calls never reaches a safe point of its own.
+    // The caller keeps its arguments and partial results on the stack.
+    if (vm->heap.gc.pending) gc_collect(vm);
+    frame_push(vm, vm->bytecode + vm->program_size);
+    vm->pc = vm->bytecode + address;
+#ifdef JIT_SUPPORTED
+    if (vm->jit) jit_enter(vm, address, address + JIT_MAX_REGION - 1);
+#endif
+    vm_run(vm);
+
+    vm->pc = resume;
+}
+
+void parse_arguments(int argc, char* argv[], VMOptions *options) {
+    options->filename = "output.o";
+    options->max_depth = RECURSION_LIMIT;
+    options->gc_stats = 0;
+    options->load_stats = 0;
+    options->gc_threshold = GC_DEFAULT_THRESHOLD;
+    options->gc_growth = GC_DEFAULT_GROWTH;
+    options->output_buffer = OUTPUT_DEFAULT_BUFFER;
+    options->unbuffered = 0;
+    options->profile = 0;
+    options->profile_output = PROFILE_DEFAULT_OUTPUT;
+    options->jit = 1;
+    options->jit_threshold = JIT_DEFAULT_THRESHOLD;
+    options->jit_stats = 0;
+    options->threads = 1;
+    options->kernels = NULL;
+    options->emit_c = NULL;
+    options->image = NULL;
+    options->image_size = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+            options->max_depth = atoi(argv[++i]);
+            if (options->max_depth < 1) {
+                fprintf(stderr, "Invalid value for --max-depth: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            options->gc_stats = 1;
+        } else if (strcmp(argv[i], "--load-stats") == 0) {
+            options->load_stats = 1;
+        } else if (strcmp(argv[i], "--gc-threshold") == 0 && i + 1 < argc) {
+            long threshold = atol(argv[++i]);
+            if (threshold < 1) {
+                fprintf(stderr, "Invalid value for --gc-threshold: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            options->gc_threshold = threshold;
+        } else if (strcmp(argv[i], "--gc-growth") == 0 && i + 1 < argc) {
+            options->gc_growth = atof(argv[++i]);
+            if (options->gc_growth < 1.0) {
+                fprintf(stderr, "Invalid value for --gc-growth: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--output-buffer") == 0 && i + 1 < argc) {
+            long bytes = atol(argv[++i]);
+            if (bytes < 1) {
+                fprintf(stderr, "Invalid value for --output-buffer: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            options->output_buffer = bytes;
+        } else if (strcmp(argv[i], "--unbuffered") == 0) {
+            options->unbuffered = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options->profile = 1;
+        } else if (strcmp(argv[i], "--profile-output") == 0 && i + 1 < argc) {
+            options->profile = 1;
+            options->profile_output = argv[++i];
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            options->jit = 0;
+        } else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc) {
+            long threshold = atol(argv[++i]);
+            if (threshold < 1) {
+                fprintf(stderr, "Invalid value for --jit-threshold: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            options->jit_threshold = threshold;
+        } else if (strcmp(argv[i], "--jit-stats") == 0) {
+            options->jit_stats = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->threads = atoi(argv[++i]);
+            if (options->threads < 1 || options->threads > 256) {
+                fprintf(stderr, "Invalid value for --threads: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc) {
+            options->kernels = argv[++i];
+            if (!kernels_select(options->kernels)) {
+                fprintf(stderr, "Invalid value for --kernels: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+            options->emit_c = argv[++i];
+        } else {
+            options->filename = argv[i];
+        }
+    }
+}
+
+// Shared by vml and programs translated with --emit-c, which pass their
+// embedded program file and translated code as image and run
+int vm_main(int argc, char *argv[], const uint8_t *image, size_t image_size, void (*run)(VM*)) {
+    VMOptions options;
+    parse_arguments(argc, argv, &options);
+    if (image) {
+        options.image = image;
+        options.image_size = image_size;
+        options.emit_c = NULL;
+        options.profile = 0;
+        options.jit = 0;
+    }
 
     VM virtual_machine;
-    vm_init(&virtual_machine, filename);
-    vm_run(&virtual_machine);
+    vm_init(&virtual_machine, &options);
+    if (options.emit_c) {
+        emit_c(&virtual_machine, options.filename, options.emit_c);
+        vm_destroy(&virtual_machine);
+        return 0;
+    }
+
+    run(&virtual_machine);
+    output_flush(&virtual_machine.output);
+    if (options.gc_stats) gc_print_stats(&virtual_machine, stderr);
+#ifdef JIT_SUPPORTED
+    if (options.jit_stats && virtual_machine.jit) jit_print_stats(virtual_machine.jit, stderr);
+#endif
+    if (virtual_machine.profile) {
+        profile_finish(virtual_machine.profile);
+        profile_report(virtual_machine.profile, virtual_machine.bytecode, stderr);
+    }
     vm_destroy(&virtual_machine);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// VM_NO_MAIN builds the runtime library translated programs link against
+#ifndef VM_NO_MAIN
+int main(int argc, char* argv[]) {
+    return vm_main(argc, argv, NULL, 0, vm_run);
+}
+#endif
@@ -2,22 +2,67 @@
 #include "includes/memory.h"
 #include "includes/stack.h"
 #include "includes/errors.h"
+#include "includes/output.h"
+#include "includes/profile.h"
 #include "stdio.h"
-#define RECURSION_LIMIT 128
+#define RECURSION_LIMIT 100000
+#define INITIAL_FRAMES 64
+
+typedef struct {
+    Instruction *return_address;
+    uint32_t local_base;        // The caller's window, restored by RETURN
+} Frame;
+
+typedef struct {
+    const char *filename;
+    int max_depth;
+    int gc_stats;
+    int load_stats;
+    size_t gc_threshold;
+    double gc_growth;
+    size_t output_buffer;
+    int unbuffered;
+    int profile;
+    const char *profile_output;
+    int jit;
+    uint32_t jit_threshold;
+    int jit_stats;
+    int threads;                // Threads map and filter may use, see parallel.h
+    const char *kernels;        // Array kernel version, NULL for the best the CPU supports
+    const char *emit_c;         // Translate the program to this C file instead of running it
+    const uint8_t *image;       // Program file embedded by a translated program, or NULL
+    size_t image_size;
+} VMOptions;
 
 typedef struct {
     int program_size;
     int frame_pointer;
+    int frame_capacity;
+    int max_depth;
     
     Stack stack;
-    Memory memory;
+    Globals globals;
+    Locals locals;
     Heap heap;
+    Output output;
+
+    Item *constants;          // Constant pool, arrays are BLOCK_CONST heap blocks
+    uint32_t constant_count;
+
+    Profile *profile;         // NULL unless running with --profile
+    struct Jit *jit;          // NULL with --no-jit or where the JIT isn't supported
+    int threads;
+    struct Pool *pool;        // map/filter workers, started by the first parallel job
 
     Instruction *pc;
     Instruction *bytecode;
-    Instruction* return_address[RECURSION_LIMIT];
+    uint8_t opcode;           // Last opcode dispatched, see instr_pc_log in errors.h
+    Frame *frames;
 } VM;
 
-void vm_init(VM *vm, const char *filename);
+void vm_init(VM *vm, const VMOptions *options);
+void vm_call(VM *vm, uint32_t address);
 void vm_destroy(VM *vm);
-void vm_run(VM *vm);
\ No newline at end of file
+void vm_run(VM *vm);
+int vm_main(int argc, char *argv[], const uint8_t *image, size_t image_size, void (*run)(VM*));
+void string_format_proc(VM *vm, Item left, Item right);
\ No newline at end of file